@@ -4,21 +4,188 @@
 #include "log.h"
 #include <stdbool.h>
 #include "comm_megawifi.h"
+#include "scheduler.h"
 #include "memory.h"
 
+#define TIMESYNC_SSRC_OFFSET 4
+#define TIMESYNC_COUNT_OFFSET 8
+#define TIMESYNC_TIMESTAMPS_OFFSET 12
+#define TIMESYNC_TIMESTAMP_LEN 8
+#define CLOCK_FILTER_WEIGHT 4
+#define RTP_VERSION 0x80
+#define RTP_MIDI_PAYLOAD_TYPE 0x61
+
+typedef struct AppleMidiSession AppleMidiSession;
+
+struct AppleMidiSession {
+    bool active;
+    u32 ssrc;
+    u32 remoteIp;
+    u16 remoteControlPort;
+    u16 remoteMidiPort;
+    RtpMidiSequence sequence;
+    RtpMidiSysEx sysex;
+    u16 lastFeedbackSeqNum;
+    u16 sendSeqNum;
+    u16 feedbackAge;
+    u16 unacknowledged;
+    u16 journalLength;
+    bool clockSynced;
+    u32 clockOffset;
+    u32 latency;
+    u32 lastHeard;
+    bool transitKnown;
+    u32 transit;
+    u32 jitter;
+};
+
+static AppleMidiSession sessions[APPLE_MIDI_MAX_SESSIONS];
+static u16 lastSeqNum = 0;
+static RtpMidiSysEx unknownSessionSysEx;
+static u16 jitterBufferCap = 0;
+
 static mw_err unpackInvitation(
     char* buffer, u16 length, AppleMidiExchangePacket* invite);
-static void sendInviteResponse(u8 ch, AppleMidiExchangePacket* invite);
+static void sendInviteResponse(u8 ch, u32 remoteIp, u16 remotePort,
+    AppleMidiExchangePacket* invite, bool accepted);
+
+void applemidi_init(void)
+{
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        sessions[i].active = false;
+    }
+    lastSeqNum = 0;
+    unknownSessionSysEx.open = false;
+    jitterBufferCap = 0;
+    rtpmidi_init();
+}
+
+static u32 readU32(const char* data)
+{
+    return ((u32)(u8)data[0] << 24) + ((u32)(u8)data[1] << 16)
+        + ((u32)(u8)data[2] << 8) + (u8)data[3];
+}
+
+static void writeU32(char* data, u32 value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static AppleMidiSession* findSession(u32 ssrc)
+{
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        if (sessions[i].active && sessions[i].ssrc == ssrc) {
+            return &sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static AppleMidiSession* touchSession(u32 ssrc)
+{
+    AppleMidiSession* session = findSession(ssrc);
+    if (session != NULL) {
+        session->lastHeard = scheduler_timestamp();
+    }
+    return session;
+}
+
+static bool isExpired(AppleMidiSession* session)
+{
+    return scheduler_timestamp() - session->lastHeard
+        > APPLE_MIDI_SESSION_TIMEOUT;
+}
+
+static AppleMidiSession* findFreeSession(void)
+{
+    AppleMidiSession* oldest = NULL;
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        AppleMidiSession* session = &sessions[i];
+        if (!session->active) {
+            return session;
+        }
+        if (isExpired(session)
+            && (oldest == NULL
+                || (s32)(session->lastHeard - oldest->lastHeard) < 0)) {
+            oldest = session;
+        }
+    }
+    if (oldest != NULL) {
+        log_info("AM: Session timed out");
+    }
+    return oldest;
+}
 
-static mw_err processInvitation(u8 ch, char* buffer, u16 length)
+static AppleMidiSession* findOrCreateSession(u32 ssrc)
+{
+    AppleMidiSession* session = touchSession(ssrc);
+    if (session != NULL) {
+        return session;
+    }
+    session = findFreeSession();
+    if (session != NULL) {
+        memset(session, 0, sizeof(AppleMidiSession));
+        session->active = true;
+        session->ssrc = ssrc;
+        session->lastHeard = scheduler_timestamp();
+    }
+    return session;
+}
+
+u8 applemidi_sessionCount(void)
+{
+    u8 count = 0;
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        if (sessions[i].active) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static mw_err processInvitation(
+    u8 ch, u32 remoteIp, u16 remotePort, char* buffer, u16 length)
 {
     AppleMidiExchangePacket packet;
     mw_err err = unpackInvitation(buffer, length, &packet);
     if (err != MW_ERR_NONE) {
         return err;
     }
+    AppleMidiSession* session
+        = findOrCreateSession(readU32(&buffer[EXCHANGE_SSRC_OFFSET]));
+    if (session == NULL) {
+        log_warn("AM: Session limit reached");
+        sendInviteResponse(ch, remoteIp, remotePort, &packet, false);
+        return MW_ERR_NONE;
+    }
+    // A re-invite starts a new stream with a new random sequence number
+    session->sequence.received = false;
+    session->sysex.open = false;
+    session->remoteIp = remoteIp;
+    if (ch == CH_CONTROL_PORT) {
+        session->remoteControlPort = remotePort;
+    } else {
+        session->remoteMidiPort = remotePort;
+    }
     log_info("AM: Session invite on UDP ch %d", ch);
-    sendInviteResponse(ch, &packet);
+    sendInviteResponse(ch, remoteIp, remotePort, &packet, true);
+    return MW_ERR_NONE;
+}
+
+static mw_err processEndSession(char* buffer, u16 length)
+{
+    if (length < APPLE_MIDI_END_SESSION_PKT_LEN) {
+        return ERR_APPLE_MIDI_EXCH_PKT_TOO_SMALL;
+    }
+    AppleMidiSession* session
+        = findSession(readU32(&buffer[EXCHANGE_SSRC_OFFSET]));
+    if (session != NULL) {
+        session->active = false;
+        log_info("AM: Session ended");
+    }
     return MW_ERR_NONE;
 }
 
@@ -41,10 +208,11 @@ static mw_err unpackInvitation(
     return MW_ERR_NONE;
 }
 
-static void packInvitationResponse(u32 initToken, char* buffer, u16* length)
+static void packInvitationResponse(
+    u32 initToken, bool accepted, char* buffer, u16* length)
 {
     AppleMidiExchangePacket response = { .signature = APPLE_MIDI_SIGNATURE,
-        .command = "OK",
+        .command = { accepted ? 'O' : 'N', accepted ? 'K' : 'O' },
         .name = "MegaDrive",
         .initToken = initToken,
         .senderSSRC = MEGADRIVE_SSRC,
@@ -56,13 +224,16 @@ static void packInvitationResponse(u32 initToken, char* buffer, u16* length)
     }
 }
 
-static char inviteSendBuffer[UDP_PKT_BUFFER_LEN];
-
-static void sendInviteResponse(u8 ch, AppleMidiExchangePacket* invite)
+static void sendInviteResponse(u8 ch, u32 remoteIp, u16 remotePort,
+    AppleMidiExchangePacket* invite, bool accepted)
 {
+    char* buffer = comm_megawifi_reserveSend();
+    if (buffer == NULL) {
+        return;
+    }
     u16 length;
-    packInvitationResponse(invite->initToken, inviteSendBuffer, &length);
-    comm_megawifi_send(ch, inviteSendBuffer, length);
+    packInvitationResponse(invite->initToken, accepted, buffer, &length);
+    comm_megawifi_queueSend(ch, remoteIp, remotePort, buffer, length);
 }
 
 static mw_err unpackTimestampSync(
@@ -82,6 +253,24 @@ static mw_err unpackTimestampSync(
     return MW_ERR_NONE;
 }
 
+static char* timestampLo(AppleMidiTimeSyncPacket* packet, u8 index)
+{
+    return (char*)&packet->byte[TIMESYNC_TIMESTAMPS_OFFSET
+        + index * TIMESYNC_TIMESTAMP_LEN + sizeof(u32)];
+}
+
+static u32 readTimestamp(AppleMidiTimeSyncPacket* packet, u8 index)
+{
+    return readU32(timestampLo(packet, index));
+}
+
+static void writeTimestamp(AppleMidiTimeSyncPacket* packet, u8 index, u32 time)
+{
+    char* lo = timestampLo(packet, index);
+    writeU32(lo - sizeof(u32), 0);
+    writeU32(lo, time);
+}
+
 static void packTimestampSync(
     AppleMidiTimeSyncPacket* timeSyncPacket, char* buffer, u16* length)
 {
@@ -92,34 +281,89 @@ static void packTimestampSync(
     }
 }
 
-char timestampSyncSendBuffer[TIMESYNC_PKT_LEN];
-
-static void sendTimestampSync(AppleMidiTimeSyncPacket* timeSyncPacket)
+static void sendTimestampSync(u32 remoteIp, u16 remotePort,
+    AppleMidiTimeSyncPacket* timeSyncPacket)
 {
+    char* buffer = comm_megawifi_reserveSend();
+    if (buffer == NULL) {
+        return;
+    }
     u16 length;
-    packTimestampSync(timeSyncPacket, timestampSyncSendBuffer, &length);
-    comm_megawifi_send(CH_MIDI_PORT, timestampSyncSendBuffer, length);
+    packTimestampSync(timeSyncPacket, buffer, &length);
+    comm_megawifi_queueSend(CH_MIDI_PORT, remoteIp, remotePort, buffer, length);
 }
 
-static mw_err processTimestampSync(char* buffer, u16 length)
+static u32 filterEstimate(u32 estimate, u32 sample, u8 weight)
+{
+    return estimate + (s32)(sample - estimate) / weight;
+}
+
+static void updateClockEstimates(AppleMidiTimeSyncPacket* packet)
+{
+    AppleMidiSession* session
+        = findSession(readU32((char*)&packet->byte[TIMESYNC_SSRC_OFFSET]));
+    if (session == NULL) {
+        return;
+    }
+    u32 sent = readTimestamp(packet, 0);
+    u32 remote = readTimestamp(packet, 1);
+    u32 received = readTimestamp(packet, 2);
+    u32 latency = (received - sent) / 2;
+    u32 offset = sent + latency - remote;
+    if (!session->clockSynced) {
+        session->clockOffset = offset;
+        session->latency = latency;
+        session->clockSynced = true;
+    } else {
+        session->clockOffset = filterEstimate(
+            session->clockOffset, offset, CLOCK_FILTER_WEIGHT);
+        session->latency = filterEstimate(
+            session->latency, latency, CLOCK_FILTER_WEIGHT);
+    }
+}
+
+static mw_err processTimestampSync(
+    u32 remoteIp, u16 remotePort, char* buffer, u16 length)
 {
     AppleMidiTimeSyncPacket packet;
     mw_err err = unpackTimestampSync(buffer, length, &packet);
     if (err != MW_ERR_NONE) {
         return err;
     }
-    if (packet.count == 0) {
-        packet.count = 1;
-        packet.timestamp2Hi = 0;
-        packet.timestamp2Lo = 0;
-        packet.senderSSRC = MEGADRIVE_SSRC;
+    touchSession(readU32((char*)&packet.byte[TIMESYNC_SSRC_OFFSET]));
+    switch (packet.byte[TIMESYNC_COUNT_OFFSET]) {
+    case 0:
+        packet.byte[TIMESYNC_COUNT_OFFSET] = 1;
+        writeTimestamp(&packet, 1, scheduler_timestamp());
+        writeU32((char*)&packet.byte[TIMESYNC_SSRC_OFFSET], MEGADRIVE_SSRC);
         log_info("AM: Timestamp Sync");
-        sendTimestampSync(&packet);
+        sendTimestampSync(remoteIp, remotePort, &packet);
+        break;
+    case 2:
+        updateClockEstimates(&packet);
+        break;
     }
-
     return MW_ERR_NONE;
 }
 
+bool applemidi_isClockSynced(u32 ssrc)
+{
+    AppleMidiSession* session = findSession(ssrc);
+    return session != NULL && session->clockSynced;
+}
+
+u32 applemidi_clockOffset(u32 ssrc)
+{
+    AppleMidiSession* session = findSession(ssrc);
+    return session != NULL ? session->clockOffset : 0;
+}
+
+u32 applemidi_latency(u32 ssrc)
+{
+    AppleMidiSession* session = findSession(ssrc);
+    return session != NULL ? session->latency : 0;
+}
+
 static bool hasAppleMidiSignature(char* buffer, u16 length)
 {
     if (length < 2) {
@@ -138,35 +382,125 @@ static bool isTimestampSyncCommand(char* command)
     return command[0] == 'C' && command[1] == 'K';
 }
 
-mw_err applemidi_processSessionControlPacket(char* buffer, u16 length)
+static bool isEndSessionCommand(char* command)
+{
+    return command[0] == 'B' && command[1] == 'Y';
+}
+
+mw_err applemidi_processSessionControlPacket(
+    u32 remoteIp, u16 remotePort, char* buffer, u16 length)
 {
     if (!hasAppleMidiSignature(buffer, length)) {
         return ERR_INVALID_APPLE_MIDI_SIGNATURE;
     }
     char* command = &buffer[2];
     if (isInvitationCommand(command)) {
-        return processInvitation(CH_CONTROL_PORT, buffer, length);
+        return processInvitation(
+            CH_CONTROL_PORT, remoteIp, remotePort, buffer, length);
+    } else if (isEndSessionCommand(command)) {
+        return processEndSession(buffer, length);
     }
 
     return MW_ERR_NONE;
 }
 
-static u16 lastSeqNum = 0;
 
-mw_err applemidi_processSessionMidiPacket(char* buffer, u16 length)
+void applemidi_setJitterBufferCap(u16 cap)
+{
+    jitterBufferCap = cap;
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        sessions[i].transitKnown = false;
+    }
+}
+
+static void updateTransit(AppleMidiSession* session, u32 transit)
+{
+    if (!session->transitKnown && session->clockSynced) {
+        // Start from the transit the CK estimates predict, rather than that
+        // of a first packet which may itself have been delayed
+        session->transit = session->latency - session->clockOffset;
+        session->jitter = 0;
+        session->transitKnown = true;
+    }
+    s32 deviation = transit - session->transit;
+    if (deviation < 0) {
+        deviation = -deviation;
+    }
+    if (!session->transitKnown || deviation > JITTER_RESYNC_TRANSIT) {
+        session->transit = transit;
+        session->jitter = 0;
+        session->transitKnown = true;
+        return;
+    }
+    session->transit
+        = filterEstimate(session->transit, transit, JITTER_FILTER_WEIGHT);
+    session->jitter
+        = filterEstimate(session->jitter, deviation, JITTER_FILTER_WEIGHT);
+}
+
+static u32 playoutTime(AppleMidiSession* session, char* buffer)
+{
+    // The sender's clock offset is part of the transit time, so playout can
+    // be keyed on its RTP timestamps even before a CK exchange.
+    u32 arrival = scheduler_timestamp();
+    if (session == NULL || jitterBufferCap == 0) {
+        return arrival;
+    }
+    u32 timestamp = readU32(&buffer[RTP_TIMESTAMP_OFFSET]);
+    updateTransit(session, arrival - timestamp);
+    u32 margin = session->jitter * JITTER_BUFFER_DEVIATIONS;
+    if (margin > jitterBufferCap) {
+        margin = jitterBufferCap;
+    }
+    s32 hold = timestamp + session->transit + margin - arrival;
+    if (hold <= 0) {
+        return arrival;
+    }
+    return arrival + (hold > jitterBufferCap ? jitterBufferCap : hold);
+}
+
+static mw_err processRtpMidiPacket(char* buffer, u16 length)
+{
+    if (length < RTP_MIDI_HEADER_LEN) {
+        return ERR_RTP_MIDI_PKT_TOO_SMALL;
+    }
+    AppleMidiSession* session
+        = touchSession(readU32(&buffer[RTP_SSRC_OFFSET]));
+    // Senders without a session may share this path, so their packets are
+    // not checked for loss, duplicates or reordering
+    RtpMidiSequence unknownSequence = { .received = false };
+    RtpMidiSequence* sequence
+        = session != NULL ? &session->sequence : &unknownSequence;
+    RtpMidiSysEx* sysex
+        = session != NULL ? &session->sysex : &unknownSessionSysEx;
+    mw_err err = rtpmidi_processRtpMidiPacket(
+        buffer, length, sequence, sysex, playoutTime(session, buffer));
+    if (session != NULL && err == MW_ERR_NONE) {
+        session->journalLength = rtpmidi_lastJournalLength();
+        session->unacknowledged++;
+    }
+    lastSeqNum = sequence->last;
+    return err;
+}
+
+mw_err applemidi_processSessionMidiPacket(
+    u32 remoteIp, u16 remotePort, char* buffer, u16 length)
 {
     if (hasAppleMidiSignature(buffer, length)) {
         char* command = &buffer[2];
         if (isInvitationCommand(command)) {
-            return processInvitation(CH_MIDI_PORT, buffer, length);
+            return processInvitation(
+                CH_MIDI_PORT, remoteIp, remotePort, buffer, length);
         } else if (isTimestampSyncCommand(command)) {
-            return processTimestampSync(buffer, length);
+            return processTimestampSync(remoteIp, remotePort, buffer, length);
+        } else if (isEndSessionCommand(command)) {
+            return processEndSession(buffer, length);
         } else {
             char text[100];
             v_sprintf(text, "Unknown event %s", command);
         }
     } else {
-        return rtpmidi_processRtpMidiPacket(buffer, length, &lastSeqNum);
+        return processRtpMidiPacket(buffer, length);
     }
 
     return MW_ERR_NONE;
@@ -179,14 +513,93 @@ u16 applemidi_lastSequenceNumber(void)
 
 #define RECEIVER_FEEDBACK_PACKET_LENGTH 12
 
-mw_err applemidi_sendReceiverFeedback(void)
+static void sendReceiverFeedback(AppleMidiSession* session)
+{
+    char* packet = comm_megawifi_reserveSend();
+    if (packet == NULL) {
+        return;
+    }
+    u16 seqNum = session->sequence.last;
+    packet[0] = 0xFF;
+    packet[1] = 0xFF;
+    packet[2] = 'R';
+    packet[3] = 'S';
+    writeU32(&packet[4], MEGADRIVE_SSRC);
+    packet[8] = seqNum >> 8;
+    packet[9] = seqNum;
+    packet[10] = 0;
+    packet[11] = 0;
+
+    comm_megawifi_queueSend(CH_CONTROL_PORT, session->remoteIp,
+        session->remoteControlPort, packet, RECEIVER_FEEDBACK_PACKET_LENGTH);
+    session->lastFeedbackSeqNum = seqNum;
+    session->feedbackAge = 0;
+    session->unacknowledged = 0;
+}
+
+static bool isFeedbackDue(AppleMidiSession* session, bool idle)
 {
-    char receiverFeedbackPacket[RECEIVER_FEEDBACK_PACKET_LENGTH]
-        = { 0xFF, 0xFF, 'R', 'S', (u8)(MEGADRIVE_SSRC >> 24),
-              (u8)(MEGADRIVE_SSRC >> 16), (u8)(MEGADRIVE_SSRC >> 8),
-              (u8)MEGADRIVE_SSRC, (u8)(lastSeqNum >> 8), (u8)lastSeqNum, 0, 0 };
+    if (idle && session->feedbackAge >= RECEIVER_FEEDBACK_MIN_FRAMES) {
+        return true;
+    }
+    return session->feedbackAge >= RECEIVER_FEEDBACK_MAX_FRAMES
+        || session->unacknowledged >= RECEIVER_FEEDBACK_MAX_PACKETS
+        || session->journalLength >= RECEIVER_FEEDBACK_JOURNAL_LEN;
+}
 
-    comm_megawifi_send(CH_CONTROL_PORT, receiverFeedbackPacket,
-        RECEIVER_FEEDBACK_PACKET_LENGTH);
+mw_err applemidi_sendReceiverFeedback(u16 frames, bool idle)
+{
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        AppleMidiSession* session = &sessions[i];
+        if (!session->active || session->remoteControlPort == 0
+            || session->sequence.last == session->lastFeedbackSeqNum) {
+            continue;
+        }
+        if (session->feedbackAge < 0xFFFF - frames) {
+            session->feedbackAge += frames;
+        }
+        if (isFeedbackDue(session, idle)) {
+            sendReceiverFeedback(session);
+        }
+    }
     return MW_ERR_NONE;
 }
+
+static u16 packRtpMidiHeader(
+    AppleMidiSession* session, char* packet, u16 length)
+{
+    u16 seqNum = session->sendSeqNum++;
+    packet[0] = RTP_VERSION;
+    packet[1] = RTP_MIDI_PAYLOAD_TYPE;
+    packet[2] = seqNum >> 8;
+    packet[3] = seqNum;
+    writeU32(&packet[4], scheduler_timestamp());
+    writeU32(&packet[RTP_SSRC_OFFSET], MEGADRIVE_SSRC);
+
+    char* commandSection = &packet[RTP_MIDI_HEADER_LEN];
+    if (length <= RTP_MIDI_SHORT_HEADER_MAX_LEN) {
+        commandSection[0] = length;
+        return RTP_MIDI_HEADER_LEN + 1;
+    }
+    commandSection[0] = 0x80 | (length >> 8);
+    commandSection[1] = length;
+    return RTP_MIDI_HEADER_LEN + 2;
+}
+
+void applemidi_sendMidi(const u8* commands, u16 length)
+{
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        AppleMidiSession* session = &sessions[i];
+        if (!session->active || session->remoteMidiPort == 0) {
+            continue;
+        }
+        char* packet = comm_megawifi_reserveSend();
+        if (packet == NULL) {
+            return;
+        }
+        u16 headerLength = packRtpMidiHeader(session, packet, length);
+        memcpy(&packet[headerLength], commands, length);
+        comm_megawifi_queueSend(CH_MIDI_PORT, session->remoteIp,
+            session->remoteMidiPort, packet, headerLength + length);
+    }
+}
@@ -1,28 +1,56 @@
 #pragma once
 #include "mw/megawifi.h"
+#include <stdbool.h>
 
 #define ERR_BASE 100
 #define ERR_INVALID_APPLE_MIDI_SIGNATURE ERR_BASE;
 #define ERR_UNEXPECTED_CHANNEL (ERR_BASE + 1)
 #define ERR_APPLE_MIDI_EXCH_PKT_TOO_SMALL (ERR_BASE + 2)
 #define ERR_INVALID_TIMESYNC_PKT_LENGTH (ERR_BASE + 3)
+#define ERR_RTP_MIDI_PKT_TOO_SMALL (ERR_BASE + 4)
 
 #define MEGADRIVE_SSRC 0x9E915150
 #define CH_CONTROL_PORT 1
 #define CH_MIDI_PORT 2
 
+#define APPLE_MIDI_MAX_SESSIONS 4
+// A session heard nothing from (no invitation, CK or RTP) for this long, in
+// 100 us units, gives up its slot to a new invitation when the table is full
+#define APPLE_MIDI_SESSION_TIMEOUT 600000
+
 #define NAME_LEN 16
 
 #define RTP_MIDI_COMMAND_SECTION_HEADER_MAX_LEN 2
 #define RTP_MIDI_HEADER_LEN (3 * 4)
 #define EXCHANGE_PACKET_LEN (16 + NAME_LEN)
-#define UDP_PKT_BUFFER_LEN 64
+#define EXCHANGE_SSRC_OFFSET 12
+#define RTP_TIMESTAMP_OFFSET 4
+#define RTP_SSRC_OFFSET 8
+#define RTP_MIDI_SHORT_HEADER_MAX_LEN 15
 #define APPLE_MIDI_EXCH_PKT_MIN_LEN 17
+#define APPLE_MIDI_END_SESSION_PKT_LEN 16
 
 #define TIMESYNC_PKT_LEN (9 * 4)
 
 #define APPLE_MIDI_SIGNATURE 0xFFFF
 
+// Receiver feedback (RS) for new packets is sent once the link is idle and
+// RECEIVER_FEEDBACK_MIN_FRAMES have passed. It is sent even when busy once
+// the host's journal or the number of unacknowledged packets grows large,
+// or after RECEIVER_FEEDBACK_MAX_FRAMES.
+#define RECEIVER_FEEDBACK_MIN_FRAMES 10
+#define RECEIVER_FEEDBACK_MAX_FRAMES 60
+#define RECEIVER_FEEDBACK_MAX_PACKETS 64
+#define RECEIVER_FEEDBACK_JOURNAL_LEN 128
+
+// With the jitter buffer enabled, events from a packet are held until its
+// RTP timestamp plus the mean transit time, plus a margin of
+// JITTER_BUFFER_DEVIATIONS times the mean deviation from it. The margin, and
+// the time any event is held, is limited to the cap (100 us units).
+#define JITTER_BUFFER_DEVIATIONS 3
+#define JITTER_FILTER_WEIGHT 16
+#define JITTER_RESYNC_TRANSIT 10000
+
 #define PACK_BIG_ENDIAN                                                        \
     __attribute__((packed, scalar_storage_order("big-endian")))
 
@@ -61,7 +89,21 @@ union PACK_BIG_ENDIAN AppleMidiExchangePacket {
 
 typedef union AppleMidiExchangePacket AppleMidiExchangePacket;
 
-mw_err applemidi_processSessionControlPacket(char* buffer, u16 length);
-mw_err applemidi_processSessionMidiPacket(char* buffer, u16 length);
+void applemidi_init(void);
+mw_err applemidi_processSessionControlPacket(
+    u32 remoteIp, u16 remotePort, char* buffer, u16 length);
+mw_err applemidi_processSessionMidiPacket(
+    u32 remoteIp, u16 remotePort, char* buffer, u16 length);
 u16 applemidi_lastSequenceNumber(void);
-mw_err applemidi_sendReceiverFeedback(void);
+u8 applemidi_sessionCount(void);
+mw_err applemidi_sendReceiverFeedback(u16 frames, bool idle);
+void applemidi_sendMidi(const u8* commands, u16 length);
+void applemidi_setJitterBufferCap(u16 cap);
+
+// Clock estimates from CK exchanges, in 100 us units (10 kHz). The offset
+// is host time minus the local scheduler_timestamp() and the latency is
+// half the measured round trip. Playout starts from the transit they
+// predict until packets have refined it.
+bool applemidi_isClockSynced(u32 ssrc);
+u32 applemidi_clockOffset(u32 ssrc);
+u32 applemidi_latency(u32 ssrc);
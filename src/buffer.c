@@ -1,19 +1,143 @@
 #include "buffer.h"
 
+#define SYSEX_START 0xF0
+#define SYSEX_END 0xF7
+#define REALTIME 0xF8
+#define COMPACT_STATUS 0xF5
+#define COMPACT_CC_DELTA 0x2
+
 static u16 readHead = 0;
 static volatile u16 writeHead = 0;
 static volatile char buffer[BUFFER_SIZE];
 static u16 length = 0;
 
+static u16 sysexReadHead;
+static volatile u16 sysexWriteHead;
+static volatile char sysexBuffer[BUFFER_SYSEX_SIZE];
+static u16 sysexLength;
+static volatile u16 sysexMessages;
+static u16 sysexMessageStart;
+static u16 sysexMessageLength;
+static bool writingSysex;
+static bool droppingSysex;
+static bool readingSysex;
+static bool sysexOpen;
+static u16 sysexSliceRemaining;
+static u16 mainReadSinceSlice;
+
+static u8 pendingData;
+static u8 runningDataLength;
+static bool compactHeader;
+
 void buffer_init(void)
 {
     readHead = 0;
     writeHead = 0;
     length = 0;
+    sysexReadHead = 0;
+    sysexWriteHead = 0;
+    sysexLength = 0;
+    sysexMessages = 0;
+    writingSysex = false;
+    droppingSysex = false;
+    readingSysex = false;
+    sysexOpen = false;
+    sysexSliceRemaining = 0;
+    mainReadSinceSlice = 0;
+    pendingData = 0;
+    runningDataLength = 0;
+    compactHeader = false;
+}
+
+static u8 dataLength(u8 status)
+{
+    switch (status >> 4) {
+    case 0xC:
+    case 0xD:
+        return 1;
+    case 0xF:
+        if (status == 0xF1 || status == 0xF3) {
+            return 1;
+        } else if (status == 0xF2) {
+            return 2;
+        }
+        return 0;
+    default:
+        return 2;
+    }
+}
+
+// Follows message boundaries in the main queue, so that a sysex message is
+// only read between whole messages and never as the data of one
+static void trackMainMessage(u8 data)
+{
+    if (data >= REALTIME) {
+        return;
+    }
+    if (data & 0x80) {
+        compactHeader = data == COMPACT_STATUS;
+        if (compactHeader) {
+            // each compact data byte after the header is a whole message
+            pendingData = 1;
+            runningDataLength = 1;
+        } else {
+            pendingData = dataLength(data);
+            runningDataLength = data < SYSEX_START ? pendingData : 0;
+        }
+    } else if (compactHeader) {
+        compactHeader = false;
+        pendingData = (data >> 4) == COMPACT_CC_DELTA ? 2 : 0;
+    } else if (pendingData != 0) {
+        pendingData--;
+    } else if (runningDataLength != 0) {
+        pendingData = runningDataLength - 1;
+    }
+}
+
+// Sysex is read in slices between main queue messages. A slice is taken
+// once the main queue is empty or has had a slice's worth of reads, so
+// neither queue can hold up the other for long.
+static bool canStartSysexSlice(void)
+{
+    return pendingData == 0 && sysexMessages != 0
+        && (length == 0 || mainReadSinceSlice >= BUFFER_SYSEX_SLICE);
+}
+
+static void startSysexSlice(void)
+{
+    readingSysex = true;
+    sysexOpen = true;
+    sysexSliceRemaining = BUFFER_SYSEX_SLICE;
+    mainReadSinceSlice = 0;
+}
+
+static u8 readSysex(void)
+{
+    u8 data = sysexBuffer[sysexReadHead];
+    sysexLength--;
+
+    sysexReadHead++;
+    if (sysexReadHead == BUFFER_SYSEX_SIZE) {
+        sysexReadHead = 0;
+    }
+    if (data == SYSEX_END) {
+        readingSysex = false;
+        sysexOpen = false;
+        sysexMessages--;
+    } else if (--sysexSliceRemaining == 0) {
+        readingSysex = false;
+    }
+    return data;
 }
 
 u8 buffer_read(void)
 {
+    if (!readingSysex && canStartSysexSlice()) {
+        startSysexSlice();
+    }
+    if (readingSysex) {
+        return readSysex();
+    }
     u8 data = buffer[readHead];
     length--;
 
@@ -21,10 +145,19 @@ u8 buffer_read(void)
     if (readHead == BUFFER_SIZE) {
         readHead = 0;
     }
+    if (mainReadSinceSlice < BUFFER_SYSEX_SLICE) {
+        mainReadSinceSlice++;
+    }
+    trackMainMessage(data);
     return data;
 }
 
-void buffer_write(u8 data)
+bool buffer_sysexSuspended(void)
+{
+    return sysexOpen && !readingSysex && !canStartSysexSlice();
+}
+
+static void writeMain(u8 data)
 {
     buffer[writeHead] = data;
     length++;
@@ -35,9 +168,75 @@ void buffer_write(u8 data)
     }
 }
 
+static void dropSysex(void)
+{
+    sysexLength -= sysexMessageLength;
+    sysexWriteHead = sysexMessageStart;
+    droppingSysex = true;
+}
+
+static void writeSysex(u8 data)
+{
+    if (droppingSysex) {
+        return;
+    }
+    if (sysexLength == BUFFER_SYSEX_SIZE) {
+        dropSysex();
+        return;
+    }
+    sysexBuffer[sysexWriteHead] = data;
+    sysexLength++;
+    sysexMessageLength++;
+
+    sysexWriteHead++;
+    if (sysexWriteHead == BUFFER_SYSEX_SIZE) {
+        sysexWriteHead = 0;
+    }
+}
+
+static void startSysex(void)
+{
+    sysexMessageStart = sysexWriteHead;
+    sysexMessageLength = 0;
+    writingSysex = true;
+    droppingSysex = false;
+    writeSysex(SYSEX_START);
+}
+
+static void endSysex(void)
+{
+    writeSysex(SYSEX_END);
+    if (!droppingSysex) {
+        sysexMessages++;
+    }
+    writingSysex = false;
+}
+
+void buffer_write(u8 data)
+{
+    if (data >= REALTIME) {
+        writeMain(data);
+    } else if (data == SYSEX_START) {
+        if (writingSysex) {
+            endSysex();
+        }
+        startSysex();
+    } else if (!writingSysex) {
+        writeMain(data);
+    } else if (data == SYSEX_END) {
+        endSysex();
+    } else if (data & 0x80) {
+        // any other status ends the sysex message
+        endSysex();
+        writeMain(data);
+    } else {
+        writeSysex(data);
+    }
+}
+
 u8 buffer_canRead(void)
 {
-    return length != 0;
+    return length != 0 || readingSysex || canStartSysexSlice();
 }
 
 u16 buffer_available(void)
@@ -45,6 +244,11 @@ u16 buffer_available(void)
     return BUFFER_SIZE - length;
 }
 
+u16 buffer_sysexAvailable(void)
+{
+    return BUFFER_SYSEX_SIZE - sysexLength;
+}
+
 bool buffer_canWrite(void)
 {
     return length != BUFFER_SIZE;
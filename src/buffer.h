@@ -3,6 +3,18 @@
 #include <stdbool.h>
 
 #define BUFFER_SIZE 2048
+#define BUFFER_SYSEX_SIZE 1024
+#define BUFFER_SYSEX_SLICE 64
+
+// Incoming MIDI bytes are split into two queues as they are written:
+// sysex messages go to their own queue and everything else to the main
+// one, so notes are not held up behind a large sysex upload. A sysex
+// message is only read once it is complete, in slices of up to
+// BUFFER_SYSEX_SLICE bytes taken between whole main queue messages. A
+// slice is taken when the main queue is empty or has had as many reads
+// since the last slice. While a sysex message is suspended between
+// slices, buffer_sysexSuspended() is true. A sysex message that overflows
+// its queue is dropped.
 
 void buffer_init(void);
 u8 buffer_read(void);
@@ -10,3 +22,5 @@ void buffer_write(u8 data);
 u8 buffer_canRead(void);
 bool buffer_canWrite(void);
 u16 buffer_available(void);
+u16 buffer_sysexAvailable(void);
+bool buffer_sysexSuspended(void);
@@ -3,15 +3,25 @@
 #include "comm_everdrive_pro.h"
 #include "comm_megawifi.h"
 #include "comm_serial.h"
+#include "buffer.h"
 #include <stdbool.h>
 #include <vdp.h>
 #include <vdp_bg.h>
 #include "vstring.h"
 #include "settings.h"
+#include "log.h"
+
+#define TX_BUFFER_SIZE 256
 
 static u16 idle = 0;
 static u16 reads = 0;
 
+static u8 txBuffer[TX_BUFFER_SIZE];
+static u16 txReadHead = 0;
+static u16 txWriteHead = 0;
+static u16 txLength = 0;
+static bool txDropping = false;
+
 static const u16 MAX_COMM_IDLE = 0x28F;
 static const u16 MAX_COMM_BUSY = 0x28F;
 
@@ -25,23 +35,28 @@ struct CommVTable {
     u8 (*read)(void);
     u8 (*writeReady)(void);
     void (*write)(u8 data);
+    void (*flush)(void);
+    bool (*sysexSuspended)(void);
 };
 
 static const CommVTable Everdrive_VTable
     = { comm_everdrive_init, comm_everdrive_readReady, comm_everdrive_read,
-          comm_everdrive_writeReady, comm_everdrive_write };
+          comm_everdrive_writeReady, comm_everdrive_write, NULL, NULL };
 
 static const CommVTable EverdrivePro_VTable = { comm_everdrive_pro_init,
     comm_everdrive_pro_readReady, comm_everdrive_pro_read,
-    comm_everdrive_pro_writeReady, comm_everdrive_pro_write };
+    comm_everdrive_pro_writeReady, comm_everdrive_pro_write,
+    comm_everdrive_pro_flush, NULL };
 
 static const CommVTable Serial_VTable
     = { comm_serial_init, comm_serial_readReady, comm_serial_read,
-          comm_serial_writeReady, comm_serial_write };
+          comm_serial_writeReady, comm_serial_write, NULL,
+          buffer_sysexSuspended };
 
 static const CommVTable Megawifi_VTable
     = { comm_megawifi_init, comm_megawifi_readReady, comm_megawifi_read,
-          comm_megawifi_writeReady, comm_megawifi_write };
+          comm_megawifi_writeReady, comm_megawifi_write, comm_megawifi_flush,
+          buffer_sysexSuspended };
 
 static const CommVTable* commTypes[] = {
 #if COMM_EVERDRIVE_X7 == 1
@@ -68,6 +83,10 @@ void comm_init(void)
         commTypes[i]->init();
     }
     activeCommType = NULL;
+    txReadHead = 0;
+    txWriteHead = 0;
+    txLength = 0;
+    txDropping = false;
 }
 
 static bool readReady(void)
@@ -105,6 +124,19 @@ u8 comm_read(void)
     return activeCommType->read();
 }
 
+bool comm_sysexQueued(void)
+{
+    // only transports that queue sysex apart from other messages can
+    // suspend it
+    return activeCommType != NULL && activeCommType->sysexSuspended != NULL;
+}
+
+bool comm_sysexSuspended(void)
+{
+    return activeCommType != NULL && activeCommType->sysexSuspended != NULL
+        && activeCommType->sysexSuspended();
+}
+
 u16 comm_idleCount(void)
 {
     return idle;
@@ -121,11 +153,48 @@ void comm_resetCounts(void)
     reads = 0;
 }
 
+u16 comm_writeAvailable(void)
+{
+    return TX_BUFFER_SIZE - txLength;
+}
+
 void comm_write(u8 data)
 {
-    while (!activeCommType->writeReady())
-        ;
-    activeCommType->write(data);
+    if (txLength == TX_BUFFER_SIZE) {
+        // Warn once for a run of dropped bytes rather than for each one
+        if (!txDropping) {
+            log_warn("Comm: TX buffer full");
+            txDropping = true;
+        }
+        return;
+    }
+    txDropping = false;
+    txBuffer[txWriteHead] = data;
+    txLength++;
+
+    txWriteHead++;
+    if (txWriteHead == TX_BUFFER_SIZE) {
+        txWriteHead = 0;
+    }
+}
+
+void comm_flush(void)
+{
+    if (activeCommType == NULL) {
+        return;
+    }
+    while (txLength != 0 && activeCommType->writeReady()) {
+        activeCommType->write(txBuffer[txReadHead]);
+        txLength--;
+
+        txReadHead++;
+        if (txReadHead == TX_BUFFER_SIZE) {
+            txReadHead = 0;
+        }
+    }
+    if (activeCommType->flush != NULL) {
+        activeCommType->flush();
+    }
 }
 
 CommMode comm_mode(void)
@@ -10,8 +10,12 @@ enum CommMode { Discovery, Everdrive, EverdrivePro, Serial, MegaWiFi };
 
 void comm_init(void);
 void comm_write(u8 data);
+u16 comm_writeAvailable(void);
+void comm_flush(void);
 bool comm_readReady(void);
 u8 comm_read(void);
+bool comm_sysexQueued(void);
+bool comm_sysexSuspended(void);
 u16 comm_idleCount(void);
 u16 comm_busyCount(void);
 void comm_resetCounts(void);
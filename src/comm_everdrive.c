@@ -7,15 +7,39 @@
 #define STE_USB_RD_RDY 4
 #define STE_USB_WR_RDY 2 // usb write ready bit
 
+#define RX_BUFFER_SIZE 256
+
+static u8 rxBuffer[RX_BUFFER_SIZE];
+static u16 rxLength;
+static u16 rxPos;
+
+static void fillRxBuffer(void)
+{
+    u16 len = 0;
+    while (len < RX_BUFFER_SIZE && (SSF_REG16(REG_STE) & STE_USB_RD_RDY)) {
+        rxBuffer[len++] = SSF_REG16(REG_USB);
+    }
+    rxLength = len;
+    rxPos = 0;
+}
+
 u8 comm_everdrive_readReady(void)
 {
+    if (rxPos != rxLength) {
+        return 1;
+    }
     return SSF_REG16(REG_STE) & STE_USB_RD_RDY;
 }
 
 u8 comm_everdrive_read(void)
 {
-    everdrive_led_blink();
-    return SSF_REG16(REG_USB);
+    if (rxPos == rxLength) {
+        everdrive_led_blink();
+        do {
+            fillRxBuffer();
+        } while (rxLength == 0);
+    }
+    return rxBuffer[rxPos++];
 }
 
 u8 comm_everdrive_writeReady(void)
@@ -30,4 +54,6 @@ void comm_everdrive_write(u8 data)
 
 void comm_everdrive_init(void)
 {
+    rxLength = 0;
+    rxPos = 0;
 }
@@ -13,6 +13,16 @@
 #define FIFO_RXF_MSK 0x7FF
 #define STAT_PRO_PRESENT 0xA0
 
+#define RX_BUFFER_SIZE 256
+#define TX_BUFFER_SIZE 256
+
+static u8 rxBuffer[RX_BUFFER_SIZE];
+static u16 rxLength;
+static u16 rxPos;
+
+static u8 txBuffer[TX_BUFFER_SIZE];
+static u16 txLength;
+
 static bool pro_present(void)
 {
     return REG_SYS_STAT & STAT_PRO_PRESENT;
@@ -73,8 +83,22 @@ static void bi_cmd_usb_wr(void* data, u16 len)
     bi_fifo_wr(data, len);
 }
 
+static void fillRxBuffer(void)
+{
+    u16 len = REG_FIFO_STAT & FIFO_RXF_MSK;
+    if (len > RX_BUFFER_SIZE) {
+        len = RX_BUFFER_SIZE;
+    }
+    bi_fifo_rd(rxBuffer, len);
+    rxLength = len;
+    rxPos = 0;
+}
+
 u8 comm_everdrive_pro_readReady(void)
 {
+    if (rxPos != rxLength) {
+        return 1;
+    }
     if (!pro_present()) {
         return 0;
     }
@@ -84,11 +108,13 @@ u8 comm_everdrive_pro_readReady(void)
 
 u8 comm_everdrive_pro_read(void)
 {
-    everdrive_led_blink();
-
-    u8 data;
-    bi_fifo_rd(&data, 1);
-    return data;
+    if (rxPos == rxLength) {
+        everdrive_led_blink();
+        do {
+            fillRxBuffer();
+        } while (rxLength == 0);
+    }
+    return rxBuffer[rxPos++];
 }
 
 u8 comm_everdrive_pro_writeReady(void)
@@ -98,10 +124,24 @@ u8 comm_everdrive_pro_writeReady(void)
 
 void comm_everdrive_pro_write(u8 data)
 {
-    bi_cmd_usb_wr(&data, 1);
-    (void)data;
+    txBuffer[txLength++] = data;
+    if (txLength == TX_BUFFER_SIZE) {
+        comm_everdrive_pro_flush();
+    }
+}
+
+void comm_everdrive_pro_flush(void)
+{
+    if (txLength == 0) {
+        return;
+    }
+    bi_cmd_usb_wr(txBuffer, txLength);
+    txLength = 0;
 }
 
 void comm_everdrive_pro_init(void)
 {
+    rxLength = 0;
+    rxPos = 0;
+    txLength = 0;
 }
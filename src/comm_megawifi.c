@@ -1,5 +1,6 @@
 #include "comm_megawifi.h"
 #include "applemidi.h"
+#include "rtpmidi.h"
 #include "log.h"
 #include "mw/loop.h"
 #include "mw/megawifi.h"
@@ -10,9 +11,16 @@
 #include "settings.h"
 #include "buffer.h"
 #include "memory.h"
+#include "scheduler.h"
+#include <stddef.h>
+#include <sys.h>
+#include <vdp.h>
 
 #define UDP_CONTROL_PORT 5006
 #define UDP_MIDI_PORT 5007
+#define UDP_IPMIDI_PORT 21928
+
+#define MIDI_SYSEX_START 0xF0
 
 #define MW_BUFLEN 1460
 #define MAX_UDP_DATA_LENGTH MW_BUFLEN
@@ -22,17 +30,68 @@ static bool mwDetected = false;
 static bool recvData = false;
 
 #define REUSE_PAYLOAD_HEADER_LEN 6
-#define RECEIVER_FEEDBACK_FRAME_FREQUENCY 10
 #define MW_MAX_LOOP_FUNCS 2
 #define MW_MAX_LOOP_TIMERS 4
 
-static char recvBuffer[MAX_UDP_DATA_LENGTH];
-static char sendBuffer[MAX_UDP_DATA_LENGTH];
+#define MODULE_RESET_FRAMES MS_TO_FRAMES(30)
+#define MODULE_BOOT_FRAMES MS_TO_FRAMES(1000)
+#define DETECT_ATTEMPTS 5
+#define COMMAND_TIMEOUT_FRAMES MS_TO_FRAMES(MW_COMMAND_TOUT_MS)
+#define ASSOC_TIMEOUT_FRAMES MS_TO_FRAMES(MW_ASSOC_TOUT_MS)
+#define STAT_POLL_FRAMES MS_TO_FRAMES(MW_STAT_POLL_MS)
+
+typedef struct UdpPort {
+    u8 ch;
+    u16 port;
+} UdpPort;
+
+static const UdpPort udpPorts[] = {
+    { CH_CONTROL_PORT, UDP_CONTROL_PORT },
+    { CH_MIDI_PORT, UDP_MIDI_PORT },
+#if MEGAWIFI_IPMIDI == 1
+    { CH_IPMIDI_PORT, UDP_IPMIDI_PORT },
+#endif
+};
+
+#define UDP_PORTS (sizeof(udpPorts) / sizeof(UdpPort))
+
+#define RECV_BUFFERS 2
+#define SEND_QUEUE_LEN 4
+#define SEND_SLOT_LEN (REUSE_PAYLOAD_HEADER_LEN + COMM_MEGAWIFI_SEND_MAX_LEN)
+
+typedef struct SendSlot {
+    char data[SEND_SLOT_LEN];
+    u16 length;
+    u8 ch;
+} SendSlot;
+
+// u32 keeps each buffer aligned for the pool's free list links
+static u32 recvBuffers[RECV_BUFFERS][MAX_UDP_DATA_LENGTH / sizeof(u32)];
+static SendSlot sendSlots[SEND_QUEUE_LEN];
+static struct mp_block_pool recvPool;
+static struct mp_block_pool sendPool;
+static char* postedRecv;
+static SendSlot* sendQueue[SEND_QUEUE_LEN];
+static u8 sendHead;
+static u8 sendCount;
 static bool awaitingRecv = false;
 static bool awaitingSend = false;
+static bool receivedThisFrame = false;
+
+typedef enum CommandReply { ReplyPending, ReplyOk, ReplyFailed } CommandReply;
+
+static u16 vsyncs = 0;
+static u16 waitStart;
+static u16 assocStart;
+static u8 attempt;
+static u8 port;
+static CommandReply reply;
+static mw_cmd* replied;
 
 static void recv_complete_cb(
     enum lsd_status stat, uint8_t ch, char* data, uint16_t len, void* ctx);
+void send_complete_cb(enum lsd_status stat, void* ctx);
+static void sendNext(void);
 
 static void mw_process_loop_cb(struct loop_func* f)
 {
@@ -47,78 +106,217 @@ static void mw_process_loop_init(void)
     loop_func_add(&loop_func);
 }
 
-static mw_err associateAp(void)
+static void logNotFound(void)
 {
-    mw_err err = mw_ap_assoc(0);
-    if (err != MW_ERR_NONE) {
-        return err;
+    if (settings_isMegaWiFiRom()) {
+        log_warn("MW: Not found");
     }
-    err = mw_ap_assoc_wait(MS_TO_FRAMES(20000));
-    if (err != MW_ERR_NONE) {
-        return err;
+}
+
+#if MEGAWIFI_HINT_DRAIN == 1
+#ifndef HINTERRUPT_CALLBACK
+#define HINTERRUPT_CALLBACK void
+#endif
+
+static HINTERRUPT_CALLBACK drainUart(void)
+{
+    uart_rx_drain();
+}
+
+// The 16C550 FIFO only holds 16 bytes (~107 us at 1.5 Mbps), so drain it
+// into the UART's receive ring from the H-int. LSD then reads from the
+// ring. The H-int does not fire during vertical blanking (~2.4 ms), so RTS
+// still throttles the module then, but no longer during active display.
+static void enableUartDrain(void)
+{
+    uart_rx_ring_enable(TRUE);
+    SYS_disableInts();
+    SYS_setHIntCallback(drainUart);
+    VDP_setHIntCounter(MEGAWIFI_HINT_DRAIN_LINES - 1);
+    VDP_setHInterrupt(TRUE);
+    SYS_enableInts();
+}
+#endif
+
+static void initBufferPools(void)
+{
+    mp_block_pool_init(
+        &recvPool, recvBuffers, sizeof(recvBuffers[0]), RECV_BUFFERS);
+    mp_block_pool_init(&sendPool, sendSlots, sizeof(SendSlot), SEND_QUEUE_LEN);
+}
+
+static u16 framesWaited(void)
+{
+    return vsyncs - waitStart;
+}
+
+static void commandReplyCb(
+    enum lsd_status stat, uint8_t ch, char* data, uint16_t len, void* ctx)
+{
+    UNUSED_PARAM(len);
+    UNUSED_PARAM(ctx);
+    replied = (mw_cmd*)data;
+    if (stat == LSD_STAT_COMPLETE && ch != MW_CTRL_CH) {
+        // A datagram on a port opened earlier, dropped until listening
+        mw_cmd_recv(replied, NULL, commandReplyCb);
+        return;
     }
-    return MW_ERR_NONE;
+    reply = stat == LSD_STAT_COMPLETE && ch == MW_CTRL_CH
+            && replied->cmd == MW_CMD_OK
+        ? ReplyOk
+        : ReplyFailed;
 }
 
-static mw_err displayLocalIp(void)
+static mw_cmd* newCommand(u16 cmd, u16 dataLength)
 {
-    struct mw_ip_cfg* ip_cfg;
-    mw_err err = mw_ip_current(&ip_cfg);
-    if (err != MW_ERR_NONE) {
-        return err;
+    mw_cmd* command = (mw_cmd*)cmd_buf;
+    command->cmd = cmd;
+    command->data_len = dataLength;
+    return command;
+}
+
+// Sends a command and returns without waiting for the reply, unlike the
+// mw_* command functions which block until it arrives
+static void sendCommand(mw_cmd* command)
+{
+    reply = ReplyPending;
+    waitStart = vsyncs;
+    mw_cmd_send(command, NULL, NULL);
+    mw_cmd_recv(command, NULL, commandReplyCb);
+}
+
+static bool commandDone(void)
+{
+    mw_process();
+    return reply != ReplyPending || framesWaited() >= COMMAND_TIMEOUT_FRAMES;
+}
+
+static bool isAssociated(void)
+{
+    return reply == ReplyOk && replied->sys_stat.sys_stat >= MW_ST_READY;
+}
+
+static void sendApJoin(u8 slot)
+{
+    mw_cmd* command = newCommand(MW_CMD_AP_JOIN, 1);
+    command->data[0] = slot;
+    sendCommand(command);
+}
+
+static void displayLocalIp(void)
+{
+    if (reply != ReplyOk) {
+        return;
     }
     char ip_str[16] = {};
-    uint32_to_ip_str(ip_cfg->addr.addr, ip_str);
+    uint32_to_ip_str(replied->ip_cfg.ip.addr.addr, ip_str);
     log_info("MW: IP: %s", ip_str);
-    return err;
 }
 
-static bool detect_mw(void)
+static void sendUdpSet(const UdpPort* udpPort)
 {
-    u8 ver_major = 0, ver_minor = 0;
-    char* variant = NULL;
-    mw_err err = mw_detect(&ver_major, &ver_minor, &variant);
-    if (MW_ERR_NONE != err) {
-        if (settings_isMegaWiFiRom()) {
-            log_warn("MW: Not found");
-        }
+    // Same message as mw_udp_set() with only the source port given, so
+    // the destination address is an empty string
+    mw_cmd* command
+        = newCommand(MW_CMD_UDP_SET, sizeof(struct mw_msg_in_addr) + 1);
+    memset(&command->in_addr, 0, command->data_len);
+    v_sprintf(command->in_addr.src_port, "%d", udpPort->port);
+    command->in_addr.channel = udpPort->ch;
+    sendCommand(command);
+}
+
+static bool udpPortOpened(const UdpPort* udpPort)
+{
+    if (reply != ReplyOk) {
+        log_warn("MW: Cannot open UDP %d", udpPort->port);
         return false;
     }
-    log_info("MW: Detected v%d.%d", ver_major, ver_minor);
+    lsd_ch_enable(udpPort->ch);
     return true;
 }
 
-static mw_err listenOnUdpPort(u8 ch, u16 src_port)
+// Brings the module up in the background, so the other transports and the
+// UI are live while it boots and joins the AP, then services it each tick.
+static PtResult megawifiTask(Pt* pt)
 {
-    char src_port_str[6];
-    v_sprintf(src_port_str, "%d", src_port);
-    mw_err err = mw_udp_set(ch, NULL, NULL, src_port_str);
-    if (err != MW_ERR_NONE) {
-        log_warn("MW: Cannot open UDP %s", src_port_str);
+    PT_BEGIN(pt);
+    waitStart = vsyncs;
+    PT_WAIT_UNTIL(pt, framesWaited() >= MODULE_RESET_FRAMES);
+    mw_start();
+    waitStart = vsyncs;
+    PT_WAIT_UNTIL(pt, framesWaited() >= MODULE_BOOT_FRAMES);
+
+    for (attempt = 0; attempt < DETECT_ATTEMPTS; attempt++) {
+        mw_reset_fifos();
+        sendCommand(newCommand(MW_CMD_VERSION, 0));
+        PT_WAIT_UNTIL(pt, commandDone());
+        if (reply == ReplyOk) {
+            break;
+        }
+    }
+    if (reply != ReplyOk) {
+        logNotFound();
+        PT_EXIT(pt);
     }
-    return err;
+    log_info("MW: Detected v%d.%d", replied->data[0], replied->data[1]);
+
+    sendApJoin(0);
+    PT_WAIT_UNTIL(pt, commandDone());
+    if (reply == ReplyOk) {
+        assocStart = vsyncs;
+        while (true) {
+            sendCommand(newCommand(MW_CMD_SYS_STAT, 0));
+            PT_WAIT_UNTIL(pt, commandDone());
+            if (isAssociated()
+                || (u16)(vsyncs - assocStart) >= ASSOC_TIMEOUT_FRAMES) {
+                break;
+            }
+            waitStart = vsyncs;
+            PT_WAIT_UNTIL(pt, framesWaited() >= STAT_POLL_FRAMES);
+        }
+    }
+    sendCommand(newCommand(MW_CMD_IP_CURRENT, 0));
+    PT_WAIT_UNTIL(pt, commandDone());
+    displayLocalIp();
+    for (port = 0; port < UDP_PORTS; port++) {
+        sendUdpSet(&udpPorts[port]);
+        PT_WAIT_UNTIL(pt, commandDone());
+        if (!udpPortOpened(&udpPorts[port])) {
+            PT_EXIT(pt);
+        }
+    }
+    log_info("MW: Listening on UDP %d", UDP_CONTROL_PORT);
+#if MEGAWIFI_HINT_DRAIN == 1
+    enableUartDrain();
+#endif
+    mwDetected = true;
+
+    while (true) {
+        PT_YIELD(pt);
+        comm_megawifi_tick();
+    }
+    PT_END(pt);
 }
 
 void comm_megawifi_init(void)
 {
-    mp_init(0);
+    mwDetected = false;
+    postedRecv = NULL;
+    sendHead = 0;
+    sendCount = 0;
+    awaitingRecv = false;
+    awaitingSend = false;
+    receivedThisFrame = false;
+    initBufferPools();
+    applemidi_init();
     mw_process_loop_init();
-    mw_init(cmd_buf, MW_BUFLEN);
-    mwDetected = detect_mw();
-    if (!mwDetected) {
-        return;
-    }
-    associateAp();
-    displayLocalIp();
-    mw_err err = listenOnUdpPort(CH_CONTROL_PORT, UDP_CONTROL_PORT);
-    if (err != MW_ERR_NONE) {
-        return;
-    }
-    err = listenOnUdpPort(CH_MIDI_PORT, UDP_MIDI_PORT);
-    if (err != MW_ERR_NONE) {
+    if (mw_init(cmd_buf, MW_BUFLEN) != MW_ERR_NONE) {
+        logNotFound();
         return;
     }
-    log_info("MW: Listening on UDP %d", UDP_CONTROL_PORT);
+    static SchedulerTask task = { .run = megawifiTask };
+    PT_INIT(&task.pt);
+    scheduler_addTask(&task);
 }
 
 u8 comm_megawifi_readReady(void)
@@ -135,24 +333,46 @@ u8 comm_megawifi_read(void)
 
 u8 comm_megawifi_writeReady(void)
 {
-    return 0;
+    return rtpmidi_canWrite();
 }
 
 void comm_megawifi_write(u8 data)
 {
-    (void)data;
+    rtpmidi_write(data);
+}
+
+void comm_megawifi_flush(void)
+{
+    rtpmidi_flush();
+}
+
+static void processIpMidiData(char* buffer, u16 length)
+{
+    recvData = true;
+    if (buffer_available() < length) {
+        log_warn("MW: MIDI buffer full!");
+        return;
+    }
+    for (u16 i = 0; i < length; i++) {
+        buffer_write(buffer[i]);
+    }
 }
 
-static void processUdpData(u8 ch, char* buffer, u16 length)
+static void processUdpData(
+    u8 ch, u32 remoteIp, u16 remotePort, char* buffer, u16 length)
 {
-    UNUSED_PARAM(buffer);
     mw_err err = MW_ERR_NONE;
     switch (ch) {
     case CH_CONTROL_PORT:
-        err = applemidi_processSessionControlPacket(buffer, length);
+        err = applemidi_processSessionControlPacket(
+            remoteIp, remotePort, buffer, length);
         break;
     case CH_MIDI_PORT:
-        err = applemidi_processSessionMidiPacket(buffer, length);
+        err = applemidi_processSessionMidiPacket(
+            remoteIp, remotePort, buffer, length);
+        break;
+    case CH_IPMIDI_PORT:
+        processIpMidiData(buffer, length);
         break;
     }
     if (err != MW_ERR_NONE) {
@@ -160,24 +380,22 @@ static void processUdpData(u8 ch, char* buffer, u16 length)
     }
 }
 
-static u32 remoteIp = 0;
-static u16 remoteControlPort = 0;
-static u16 remoteMidiPort = 0;
-
-static void persistRemoteEndpoint(u8 ch, u32 ip, u16 port)
+static void postRecv(void)
 {
-    remoteIp = ip;
-    if (ch == CH_CONTROL_PORT) {
-        remoteControlPort = port;
-    } else if (ch == CH_MIDI_PORT) {
-        remoteMidiPort = port;
+    if (postedRecv == NULL) {
+        postedRecv = mp_block_alloc(&recvPool);
+        if (postedRecv == NULL) {
+            return;
+        }
+    }
+    awaitingRecv = true;
+    enum lsd_status stat = mw_udp_reuse_recv(
+        (struct mw_reuse_payload*)postedRecv, MW_BUFLEN, NULL,
+        recv_complete_cb);
+    if (stat < 0) {
+        log_warn("MW: mw_udp_reuse_recv() = %d", stat);
+        awaitingRecv = false;
     }
-}
-
-static void restoreRemoteEndpoint(u8 ch, u32* ip, u16* port)
-{
-    *ip = remoteIp;
-    *port = (ch == CH_CONTROL_PORT) ? remoteControlPort : remoteMidiPort;
 }
 
 static void recv_complete_cb(
@@ -185,36 +403,42 @@ static void recv_complete_cb(
 {
     UNUSED_PARAM(ctx);
 
-    if (LSD_STAT_COMPLETE == stat) {
-        struct mw_reuse_payload* udp = (struct mw_reuse_payload*)data;
-        persistRemoteEndpoint(ch, udp->remote_ip, udp->remote_port);
-        processUdpData(ch, udp->payload, len);
-    } else {
+    if (LSD_STAT_COMPLETE != stat) {
         log_warn("MW: recv_complete_cb() = %d", stat);
+        awaitingRecv = false;
+        return;
     }
-    awaitingRecv = false;
+    // Post the next recv into another buffer first, so the UART
+    // keeps draining while this datagram is processed
+    postedRecv = NULL;
+    postRecv();
+    struct mw_reuse_payload* udp = (struct mw_reuse_payload*)data;
+    receivedThisFrame = true;
+    if (len >= REUSE_PAYLOAD_HEADER_LEN) {
+        processUdpData(ch, udp->remote_ip, udp->remote_port, udp->payload,
+            len - REUSE_PAYLOAD_HEADER_LEN);
+    }
+    mp_block_free(&recvPool, data);
 }
 
 static u16 frame = 0;
 
 void comm_megawifi_vsync(void)
 {
+    vsyncs++;
     frame++;
 }
 
-static u16 lastSeqNum = 0;
-
+// Feedback is held back while datagrams are arriving or sends are queued,
+// so it goes out in the gaps rather than competing with them
 static void sendReceiverFeedback(void)
 {
-    if (frame < RECEIVER_FEEDBACK_FRAME_FREQUENCY) {
+    if (frame == 0) {
         return;
     }
-
-    u16 seqNum = applemidi_lastSequenceNumber();
-    if (lastSeqNum != seqNum) {
-        applemidi_sendReceiverFeedback();
-        lastSeqNum = seqNum;
-    }
+    bool idle = !receivedThisFrame && sendCount == 0;
+    applemidi_sendReceiverFeedback(frame, idle);
+    receivedThisFrame = false;
     frame = 0;
 }
 
@@ -223,30 +447,54 @@ void comm_megawifi_tick(void)
     if (!mwDetected)
         return;
     mw_process();
-    if (awaitingRecv || awaitingSend) {
-        return;
-    }
+    rtpmidi_tick();
     sendReceiverFeedback();
-
-    awaitingRecv = true;
-    struct mw_reuse_payload* pkt = (struct mw_reuse_payload* const)recvBuffer;
-    enum lsd_status stat
-        = mw_udp_reuse_recv(pkt, MW_BUFLEN, NULL, recv_complete_cb);
-    if (stat < 0) {
-        log_warn("MW: mw_udp_reuse_recv() = %d", stat);
-        awaitingRecv = false;
-        return;
+    sendNext();
+    if (!awaitingRecv) {
+        postRecv();
     }
 }
 
-void comm_megawifi_midiEmitCallback(u8 data)
+void comm_megawifi_midiEmit(u8 status, u8* data, u16 length)
 {
     recvData = true;
-    if (!buffer_canWrite()) {
+    u16 available = status == MIDI_SYSEX_START ? buffer_sysexAvailable()
+                                               : buffer_available();
+    if (available <= length) {
         log_warn("MW: MIDI buffer full!");
         return;
     }
-    buffer_write(data);
+    buffer_write(status);
+    for (u16 i = 0; i < length; i++) {
+        buffer_write(data[i]);
+    }
+}
+
+static void dequeueSend(void)
+{
+    mp_block_free(&sendPool, sendQueue[sendHead]);
+    sendHead = (sendHead + 1) % SEND_QUEUE_LEN;
+    sendCount--;
+}
+
+static void sendNext(void)
+{
+    if (awaitingSend || sendCount == 0) {
+        return;
+    }
+    SendSlot* slot = sendQueue[sendHead];
+    enum lsd_status stat = mw_udp_reuse_send(slot->ch,
+        (struct mw_reuse_payload*)slot->data, slot->length, NULL,
+        send_complete_cb);
+    if (stat == LSD_STAT_ERR_IN_PROGRESS) {
+        return;
+    }
+    if (stat < 0) {
+        log_warn("MW: mw_udp_reuse_send() = %d", stat);
+        dequeueSend();
+        return;
+    }
+    awaitingSend = true;
 }
 
 void send_complete_cb(enum lsd_status stat, void* ctx)
@@ -256,13 +504,42 @@ void send_complete_cb(enum lsd_status stat, void* ctx)
         log_warn("MW: send_complete_cb() = %d", stat);
     }
     awaitingSend = false;
+    dequeueSend();
+    sendNext();
 }
 
-void comm_megawifi_send(u8 ch, char* data, u16 len)
+char* comm_megawifi_reserveSend(void)
 {
-    struct mw_reuse_payload* udp = (struct mw_reuse_payload*)sendBuffer;
-    restoreRemoteEndpoint(ch, &udp->remote_ip, &udp->remote_port);
-    memcpy(udp->payload, data, len);
+    SendSlot* slot = mp_block_alloc(&sendPool);
+    if (slot == NULL) {
+        log_warn("MW: Send queue full!");
+        return NULL;
+    }
+    return ((struct mw_reuse_payload*)slot->data)->payload;
+}
+
+static SendSlot* slotOfPayload(char* payload)
+{
+    return (SendSlot*)(payload - offsetof(struct mw_reuse_payload, payload)
+        - offsetof(SendSlot, data));
+}
+
+void comm_megawifi_queueSend(
+    u8 ch, u32 remoteIp, u16 remotePort, char* payload, u16 len)
+{
+    SendSlot* slot = slotOfPayload(payload);
+    if (len > COMM_MEGAWIFI_SEND_MAX_LEN) {
+        log_warn("MW: Send too large (%d)", len);
+        mp_block_free(&sendPool, slot);
+        return;
+    }
+    sendQueue[(sendHead + sendCount) % SEND_QUEUE_LEN] = slot;
+    struct mw_reuse_payload* udp = (struct mw_reuse_payload*)slot->data;
+    udp->remote_ip = remoteIp;
+    udp->remote_port = remotePort;
+    slot->length = len + REUSE_PAYLOAD_HEADER_LEN;
+    slot->ch = ch;
+    sendCount++;
 
 #if DEBUG_MEGAWIFI_SEND == 1
     char ip_buf[16];
@@ -270,12 +547,5 @@ void comm_megawifi_send(u8 ch, char* data, u16 len)
     log_info("MW: Send IP=%s:%d L=%d C=%d", ip_buf, udp->remote_port, len, ch);
 #endif
 
-    awaitingSend = true;
-    enum lsd_status stat = mw_udp_reuse_send(
-        ch, udp, len + REUSE_PAYLOAD_HEADER_LEN, NULL, send_complete_cb);
-    if (stat < 0) {
-        log_warn("MW: mw_udp_reuse_send() = %d", stat);
-        awaitingSend = false;
-        return;
-    }
+    sendNext();
 }
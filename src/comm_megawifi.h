@@ -2,13 +2,26 @@
 #include <stdint.h>
 #include <types.h>
 
+// UDP channel for plain ipMIDI datagrams (see MEGAWIFI_IPMIDI)
+#define CH_IPMIDI_PORT 3
+
 void comm_megawifi_init(void);
 u8 comm_megawifi_readReady(void);
 u8 comm_megawifi_read(void);
 u8 comm_megawifi_writeReady(void);
 void comm_megawifi_write(u8 data);
+void comm_megawifi_flush(void);
 
 void comm_megawifi_tick(void);
-void comm_megawifi_midiEmitCallback(u8 data);
-void comm_megawifi_send(u8 ch, char* data, u16 len);
+void comm_megawifi_midiEmit(u8 status, u8* data, u16 length);
+
+// Largest UDP payload that fits in a comm_megawifi_reserveSend() buffer
+#define COMM_MEGAWIFI_SEND_MAX_LEN 250
+
+// Returns a payload buffer in a free send slot for the packet to be built
+// in, or NULL if all slots are in use. The buffer must then be passed to
+// comm_megawifi_queueSend().
+char* comm_megawifi_reserveSend(void);
+void comm_megawifi_queueSend(
+    u8 ch, u32 remoteIp, u16 remotePort, char* payload, u16 len);
 void comm_megawifi_vsync(void);
@@ -2,6 +2,7 @@
 #include "envelopes.h"
 #include "log.h"
 #include "midi.h"
+#include "midi_bundle.h"
 #include "midi_receiver.h"
 #include "presets.h"
 #include "scheduler.h"
@@ -18,6 +19,7 @@ int main()
     comm_init();
     midi_init(M_BANK_0, P_BANK_0, ENVELOPES);
     midi_receiver_init();
+    midi_bundle_init();
     ui_init();
     SYS_setVIntAligned(false);
     SYS_setVIntCallback(scheduler_vsync);
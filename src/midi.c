@@ -1,8 +1,10 @@
 #include "midi.h"
+#include "applemidi.h"
 #include "comm.h"
 #include "log.h"
 #include "memcmp.h"
 #include "memory.h"
+#include "midi_bundle.h"
 #include "midi_fm.h"
 #include "midi_psg.h"
 #include "midi_sender.h"
@@ -500,6 +502,12 @@ static void setStickToDeviceType(bool enable)
     stickToDeviceType = enable;
 }
 
+static void setJitterBufferCap(u8 milliseconds)
+{
+    const u16 TIMESTAMP_UNITS_PER_MS = 10;
+    applemidi_setJitterBufferCap(milliseconds * TIMESTAMP_UNITS_PER_MS);
+}
+
 static void loadPsgEnvelope(const u8* data, u16 length)
 {
     u8 buffer[256];
@@ -520,6 +528,8 @@ void midi_sysex(const u8* data, u16 length)
     const u8 SYSEX_NON_GENERAL_MIDI_CCS_COMMAND_ID = 0x04;
     const u8 SYSEX_STICK_TO_DEVICE_TYPE_COMMAND_ID = 0x05;
     const u8 SYSEX_LOAD_PSG_ENVELOPE_COMMAND_ID = 0x06;
+    const u8 SYSEX_JITTER_BUFFER_COMMAND_ID = 0x07;
+    const u8 SYSEX_BUNDLE_COMMAND_ID = 0x08;
 
     const u8 GENERAL_MIDI_RESET_SEQUENCE[] = { 0x7E, 0x7F, 0x09, 0x01 };
 
@@ -547,6 +557,14 @@ void midi_sysex(const u8* data, u16 length)
         = { SYSEX_EXTENDED_MANU_ID_SECTION, SYSEX_UNUSED_EUROPEAN_SECTION,
               SYSEX_UNUSED_MANU_ID, SYSEX_LOAD_PSG_ENVELOPE_COMMAND_ID };
 
+    const u8 JITTER_BUFFER_SEQUENCE[]
+        = { SYSEX_EXTENDED_MANU_ID_SECTION, SYSEX_UNUSED_EUROPEAN_SECTION,
+              SYSEX_UNUSED_MANU_ID, SYSEX_JITTER_BUFFER_COMMAND_ID };
+
+    const u8 BUNDLE_SEQUENCE[]
+        = { SYSEX_EXTENDED_MANU_ID_SECTION, SYSEX_UNUSED_EUROPEAN_SECTION,
+              SYSEX_UNUSED_MANU_ID, SYSEX_BUNDLE_COMMAND_ID };
+
     if (sysex_valid(data, length, GENERAL_MIDI_RESET_SEQUENCE,
             LENGTH_OF(GENERAL_MIDI_RESET_SEQUENCE), 0)) {
         generalMidiReset();
@@ -565,11 +583,18 @@ void midi_sysex(const u8* data, u16 length)
     } else if (sysex_valid(data, length, STICK_TO_DEVICE_TYPE_SEQUENCE,
                    LENGTH_OF(STICK_TO_DEVICE_TYPE_SEQUENCE), 1)) {
         setStickToDeviceType((bool)data[4]);
+    } else if (sysex_valid(data, length, JITTER_BUFFER_SEQUENCE,
+                   LENGTH_OF(JITTER_BUFFER_SEQUENCE), 1)) {
+        setJitterBufferCap(data[4]);
 
     } else if (memcmp(data, LOAD_PSG_ENVELOPE_SEQUENCE,
                    LENGTH_OF(LOAD_PSG_ENVELOPE_SEQUENCE))
         == 0) {
         loadPsgEnvelope(data, length);
+    } else if (length >= LENGTH_OF(BUNDLE_SEQUENCE)
+        && memcmp(data, BUNDLE_SEQUENCE, LENGTH_OF(BUNDLE_SEQUENCE)) == 0) {
+        midi_bundle_queue(&data[LENGTH_OF(BUNDLE_SEQUENCE)],
+            length - LENGTH_OF(BUNDLE_SEQUENCE));
     }
 }
 
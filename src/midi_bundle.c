@@ -0,0 +1,166 @@
+#include "midi_bundle.h"
+#include "midi.h"
+#include "scheduler.h"
+#include "log.h"
+#include <stdbool.h>
+
+#define STATUS_LOWER(status) (status & 0x0F)
+#define STATUS_UPPER(status) (status >> 4)
+
+#define EVENT_NOTE_OFF 0x8
+#define EVENT_NOTE_ON 0x9
+#define EVENT_CC 0xB
+#define EVENT_PROGRAM 0xC
+#define EVENT_PITCH_BEND 0xE
+
+#define HOST_TIME_MASK 0x0FFFFFFF
+
+typedef struct BundledEvent {
+    u32 due;
+    u8 status;
+    u8 data[2];
+} BundledEvent;
+
+static BundledEvent events[MAX_BUNDLE_EVENTS];
+static u8 head;
+static u8 count;
+static bool clockSynced;
+static u32 clockOffset;
+
+void midi_bundle_init(void)
+{
+    head = 0;
+    count = 0;
+    clockSynced = false;
+}
+
+static u8 dataLength(u8 status)
+{
+    switch (STATUS_UPPER(status)) {
+    case 0xC:
+    case 0xD:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+static bool isDue(u32 due, u32 now)
+{
+    return (s32)(due - now) <= 0;
+}
+
+static BundledEvent* eventAt(u8 index)
+{
+    return &events[(head + index) % MAX_BUNDLE_EVENTS];
+}
+
+static void playEvent(BundledEvent* event)
+{
+    u8 chan = STATUS_LOWER(event->status);
+    switch (STATUS_UPPER(event->status)) {
+    case EVENT_NOTE_ON:
+        midi_noteOn(chan, event->data[0], event->data[1]);
+        break;
+    case EVENT_NOTE_OFF:
+        midi_noteOff(chan, event->data[0]);
+        break;
+    case EVENT_CC:
+        midi_cc(chan, event->data[0], event->data[1]);
+        break;
+    case EVENT_PROGRAM:
+        midi_program(chan, event->data[0]);
+        break;
+    case EVENT_PITCH_BEND:
+        midi_pitchBend(chan, (event->data[1] << 7) + event->data[0]);
+        break;
+    }
+}
+
+static void playEarliestEvent(void)
+{
+    playEvent(eventAt(0));
+    head = (head + 1) % MAX_BUNDLE_EVENTS;
+    count--;
+}
+
+static void insertEvent(u32 due, u8 status, const u8* data)
+{
+    if (count == MAX_BUNDLE_EVENTS) {
+        log_warn("Bundle: Queue full");
+        playEarliestEvent();
+    }
+    u8 index = count;
+    while (index != 0 && !isDue(eventAt(index - 1)->due, due)) {
+        *eventAt(index) = *eventAt(index - 1);
+        index--;
+    }
+    BundledEvent* event = eventAt(index);
+    event->due = due;
+    event->status = status;
+    event->data[0] = data[0];
+    event->data[1] = dataLength(status) == 2 ? data[1] : 0;
+    count++;
+}
+
+static u32 read7BitValue(const u8* data, u8 length)
+{
+    u32 value = 0;
+    for (u8 i = 0; i < length; i++) {
+        value = (value << 7) + (data[i] & 0x7F);
+    }
+    return value;
+}
+
+static void updateClockOffset(u32 hostSent)
+{
+    // Slower deliveries only nudge the offset up, so it follows clock
+    // drift but not transport jitter
+    u32 offset = scheduler_timestamp() - hostSent;
+    s32 deviation = offset - clockOffset;
+    if (!clockSynced || deviation < -BUNDLE_RESYNC_TIME
+        || deviation > BUNDLE_RESYNC_TIME) {
+        clockOffset = offset;
+        clockSynced = true;
+    } else if (deviation < 0) {
+        clockOffset = offset;
+    } else if (deviation > 0) {
+        clockOffset++;
+    }
+}
+
+void midi_bundle_queue(const u8* data, u16 length)
+{
+    if (length < BUNDLE_HEADER_LEN) {
+        log_warn("Bundle: Too short");
+        return;
+    }
+    u32 target = read7BitValue(data, 4);
+    u32 lookahead = read7BitValue(&data[4], 2);
+    u32 hostSent = (target - lookahead) & HOST_TIME_MASK;
+    updateClockOffset(hostSent);
+    u32 due = hostSent + clockOffset + lookahead;
+
+    const u8* cursor = &data[BUNDLE_HEADER_LEN];
+    const u8* end = data + length;
+    while (cursor < end) {
+        u8 status = *cursor++ | 0x80;
+        if (status >= 0xF0 || cursor + dataLength(status) > end) {
+            log_warn("Bundle: Invalid event %02X", status);
+            return;
+        }
+        insertEvent(due, status, cursor);
+        cursor += dataLength(status);
+    }
+}
+
+void midi_bundle_tick(void)
+{
+    if (count == 0) {
+        return;
+    }
+    u32 now = scheduler_timestamp();
+    while (count != 0 && isDue(eventAt(0)->due, now)) {
+        playEarliestEvent();
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <stdint.h>
+#include <types.h>
+
+// A bundle is sent as the sysex 00 22 77 08, followed by:
+//   t3 t2 t1 t0  target time on the host clock (28 bits, 100 us units)
+//   l1 l0        lookahead: target time minus host time at sending (14 bits)
+//   events...    channel voice messages with the status top bit cleared
+// The events are played together once the target time is reached. The
+// host clock is mapped to scheduler_timestamp() from the fastest observed
+// bundle delivery, so transport delays within the lookahead are absorbed.
+
+#define MAX_BUNDLE_EVENTS 64
+#define BUNDLE_HEADER_LEN 6
+#define BUNDLE_RESYNC_TIME 10000
+
+void midi_bundle_init(void);
+void midi_bundle_queue(const u8* data, u16 length);
+void midi_bundle_tick(void);
@@ -24,8 +24,20 @@
 #define SYSTEM_CONTINUE 0xB
 #define SYSTEM_SONG_POSITION 0x2
 #define SYSTEM_SYSEX 0x0
+#define SYSTEM_COMPACT 0x5
 #define SYSTEM_RESET 0xF
 
+#define IS_STATUS(byte) (byte & 0x80)
+#define IS_SYSTEM_REALTIME(status) (status >= 0xF8)
+#define STATUS_SYSEX 0xF0
+
+#define COMPACT_NOTE_ON 0x0
+#define COMPACT_NOTE_OFF 0x1
+#define COMPACT_CC_DELTA 0x2
+
+#define DEFAULT_VELOCITY 127
+#define SYSEX_BUFFER_LENGTH 256
+
 static void noteOn(u8 status);
 static void noteOff(u8 status);
 static void controlChange(u8 status);
@@ -34,9 +46,30 @@ static void systemMessage(u8 status);
 static void program(u8 status);
 static u16 read14bitValue(void);
 static void readSysEx(void);
+static void compactStatus(void);
+static void compactData(u8 data);
+
+static u8 runningStatus;
+static bool hasPendingData;
+static u8 pendingData;
+static u8 sysexData[SYSEX_BUFFER_LENGTH];
+static u16 sysexLength;
+static bool sysexOpen;
+static u8 lastVelocity[MIDI_CHANNELS];
+
+static u8 compactType;
+static u8 compactChan;
+static u8 compactController;
+static u8 compactValue;
 
 void midi_receiver_init(void)
 {
+    runningStatus = 0;
+    hasPendingData = false;
+    sysexOpen = false;
+    for (u8 chan = 0; chan < MIDI_CHANNELS; chan++) {
+        lastVelocity[chan] = DEFAULT_VELOCITY;
+    }
 }
 
 void midi_receiver_readIfCommReady(void)
@@ -61,10 +94,45 @@ static void debugPrintEvent(u8 status, u8 data1, u8 data2)
 #endif
 }
 
+static u8 readData(void)
+{
+    if (hasPendingData) {
+        hasPendingData = false;
+        return pendingData;
+    }
+    return comm_read();
+}
+
 void midi_receiver_read(void)
 {
-    u8 status = comm_read();
+    if (sysexOpen && !comm_sysexSuspended()) {
+        readSysEx();
+        return;
+    }
+    u8 status = readData();
+    if (!IS_STATUS(status)) {
+        if (runningStatus == 0) {
+            log_warn("Status? %02X", status);
+            return;
+        }
+        if (runningStatus == (0xF0 | SYSTEM_COMPACT)) {
+            compactData(status);
+            return;
+        }
+        pendingData = status;
+        hasPendingData = true;
+        status = runningStatus;
+    }
+
     u8 event = STATUS_UPPER(status);
+    if (event != EVENT_SYSTEM) {
+        runningStatus = status;
+    } else if (!IS_SYSTEM_REALTIME(status)
+        && (status != STATUS_SYSEX || !comm_sysexQueued())) {
+        // sysex queued apart from other messages may be read between
+        // messages sent with running status, so only inline sysex ends it
+        runningStatus = 0;
+    }
     switch (event) {
     case EVENT_NOTE_ON:
         noteOn(status);
@@ -85,6 +153,7 @@ void midi_receiver_read(void)
         systemMessage(status);
         break;
     default:
+        runningStatus = 0;
         log_warn("Status? %02X", status);
         break;
     }
@@ -93,7 +162,7 @@ void midi_receiver_read(void)
 static void controlChange(u8 status)
 {
     u8 chan = STATUS_LOWER(status);
-    u8 controller = comm_read();
+    u8 controller = readData();
     u8 value = comm_read();
     debugPrintEvent(status, controller, value);
     midi_cc(chan, controller, value);
@@ -102,8 +171,11 @@ static void controlChange(u8 status)
 static void noteOn(u8 status)
 {
     u8 chan = STATUS_LOWER(status);
-    u8 pitch = comm_read();
+    u8 pitch = readData();
     u8 velocity = comm_read();
+    if (velocity != 0) {
+        lastVelocity[chan] = velocity;
+    }
     debugPrintEvent(status, pitch, velocity);
     midi_noteOn(chan, pitch, velocity);
 }
@@ -111,7 +183,7 @@ static void noteOn(u8 status)
 static void noteOff(u8 status)
 {
     u8 chan = STATUS_LOWER(status);
-    u8 pitch = comm_read();
+    u8 pitch = readData();
     comm_read();
     debugPrintEvent(status, pitch, 0);
     midi_noteOff(chan, pitch);
@@ -128,14 +200,14 @@ static void pitchBend(u8 status)
 static void program(u8 status)
 {
     u8 chan = STATUS_LOWER(status);
-    u8 program = comm_read();
+    u8 program = readData();
     debugPrintEvent(status, program, 0);
     midi_program(chan, program);
 }
 
 static u16 read14bitValue(void)
 {
-    u16 lower = comm_read();
+    u16 lower = readData();
     u16 upper = comm_read();
     return (upper << 7) + lower;
 }
@@ -154,8 +226,13 @@ static void systemMessage(u8 status)
     case SYSTEM_STOP:
         break;
     case SYSTEM_SYSEX:
+        sysexLength = 0;
+        sysexOpen = true;
         readSysEx();
         break;
+    case SYSTEM_COMPACT:
+        compactStatus();
+        break;
     case SYSTEM_RESET:
         log_warn("Reset all");
         midi_reset();
@@ -168,14 +245,76 @@ static void systemMessage(u8 status)
 
 static void readSysEx(void)
 {
-    const u16 BUFFER_LENGTH = 256;
     const u8 SYSEX_END = 0xF7;
 
-    u8 buffer[BUFFER_LENGTH];
-    u8 data;
-    u16 index = 0;
-    while (index < BUFFER_LENGTH && (data = comm_read()) != SYSEX_END) {
-        buffer[index++] = data;
+    while (true) {
+        if (comm_sysexSuspended()) {
+            // other messages are read first, then the sysex is resumed
+            return;
+        }
+        u8 data = comm_read();
+        if (data == SYSEX_END) {
+            break;
+        }
+        if (IS_STATUS(data)) {
+            if (IS_SYSTEM_REALTIME(data)) {
+                continue;
+            }
+            // an unterminated sysex is ended by the next status
+            pendingData = data;
+            hasPendingData = true;
+            break;
+        }
+        // read through to the end so the excess is not taken for MIDI data
+        if (sysexLength < SYSEX_BUFFER_LENGTH) {
+            sysexData[sysexLength++] = data;
+        }
+    }
+    sysexOpen = false;
+    midi_sysex(sysexData, sysexLength);
+}
+
+static void compactStatus(void)
+{
+    u8 header = comm_read();
+    compactType = STATUS_UPPER(header);
+    compactChan = STATUS_LOWER(header);
+    switch (compactType) {
+    case COMPACT_NOTE_ON:
+    case COMPACT_NOTE_OFF:
+        break;
+    case COMPACT_CC_DELTA:
+        compactController = comm_read();
+        compactValue = comm_read();
+        midi_cc(compactChan, compactController, compactValue);
+        break;
+    default:
+        log_warn("Compact? %02X", header);
+        return;
+    }
+    runningStatus = 0xF0 | SYSTEM_COMPACT;
+}
+
+static void compactData(u8 data)
+{
+    switch (compactType) {
+    case COMPACT_NOTE_ON:
+        midi_noteOn(compactChan, data, lastVelocity[compactChan]);
+        break;
+    case COMPACT_NOTE_OFF:
+        midi_noteOff(compactChan, data);
+        break;
+    case COMPACT_CC_DELTA: {
+        s8 delta = (data & 0x40) ? (s8)(data - 0x80) : (s8)data;
+        s16 value = compactValue + delta;
+        if (value < 0) {
+            value = 0;
+        } else if (value > 0x7F) {
+            value = 0x7F;
+        }
+        compactValue = value;
+        midi_cc(compactChan, compactController, compactValue);
+        break;
+    }
     }
-    midi_sysex(buffer, index);
 }
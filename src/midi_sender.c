@@ -1,8 +1,14 @@
 #include "midi_sender.h"
 #include "comm.h"
+#include "log.h"
 
 void midi_sender_send_sysex(const u8* data, u16 length)
 {
+    // Sent whole or not at all, so the host never sees a truncated sysex
+    if (comm_writeAvailable() < length + 2) {
+        log_warn("MIDI: Sysex dropped, TX buffer full");
+        return;
+    }
     comm_write(0xF0);
     for (u16 i = 0; i < length; i++) {
 
@@ -3,6 +3,11 @@
 /// Shadow copy of the UART registers
 UartShadow sh;
 
+#if MEGAWIFI_HINT_DRAIN == 1
+/// Receive ring, filled by uart_rx_drain()
+struct uart_rx_ring rx_ring;
+#endif
+
 void uart_init(void) {
 	// Set line to BR,8N1. LCR[7] must be set to access DLX registers
 	UART_LCR = 0x83;
@@ -29,3 +34,24 @@ void uart_init(void) {
 	// (shame on Masami Ishikawa for not including a single interrupt line!).
 }
 
+#if MEGAWIFI_HINT_DRAIN == 1
+void uart_rx_drain(void) {
+	uint16_t head = rx_ring.head;
+	uint16_t next = (head + 1) & (UART_RX_RING_LEN - 1);
+
+	while (next != rx_ring.tail && (UART_LSR & 0x01)) {
+		rx_ring.buf[head] = UART_RHR;
+		head = next;
+		next = (head + 1) & (UART_RX_RING_LEN - 1);
+	}
+	rx_ring.head = head;
+}
+
+void uart_rx_ring_enable(uint8_t enable) {
+	if (enable) {
+		rx_ring.head = 0;
+		rx_ring.tail = 0;
+	}
+	rx_ring.enabled = enable;
+}
+#endif
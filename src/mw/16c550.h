@@ -12,9 +12,18 @@
 
 // Warning, stdint conflicts with some SGDK type definitions!
 #include <stdint.h>
+#include "settings.h"
 
+#ifdef MW_HOST
+/// Host builds back the UART registers with RAM. Data goes through the
+/// MegaWiFi stand-in instead (see tests/netbench).
+extern volatile uint8_t uart_host_regs[];
+/// 16C550 UART base address
+#define UART_BASE		((uintptr_t)uart_host_regs)
+#else
 /// 16C550 UART base address
 #define UART_BASE		0xA130C1
+#endif
 
 /// Clock applied to 16C550 chip. Currently using 24 MHz crystal
 #define UART_CLK		24000000LU
@@ -82,6 +91,23 @@ typedef struct {
 /// Uart shadow registers. Do NOT access directly!
 extern UartShadow sh;
 
+#if MEGAWIFI_HINT_DRAIN == 1
+/// Length of the software receive ring. Must be a power of two.
+#define UART_RX_RING_LEN	2048
+
+/// Software receive ring, filled by uart_rx_drain() from an interrupt
+/// handler and emptied by uart_getc() while enabled.
+struct uart_rx_ring {
+	volatile uint8_t buf[UART_RX_RING_LEN];	///< Received bytes
+	volatile uint16_t head;	///< Write position (interrupt side)
+	volatile uint16_t tail;	///< Read position (main loop side)
+	uint8_t enabled;	///< Reads go through the ring when set
+};
+
+/// Receive ring. Do NOT access directly!
+extern struct uart_rx_ring rx_ring;
+#endif
+
 /** \addtogroup UartOuts UartOuts
  *  \brief Output pins controlled by the MCR UART
  *  register.
@@ -118,7 +144,12 @@ void uart_init(void);
  *
  * \return TRUE if at least 1 byte is available, FALSE otherwise.
  ****************************************************************************/
+#if MEGAWIFI_HINT_DRAIN == 1
+#define uart_rx_ready()	(rx_ring.enabled ? rx_ring.head != rx_ring.tail : \
+		(UART_LSR & 0x01))
+#else
 #define uart_rx_ready()	(UART_LSR & 0x01)
+#endif
 
 /************************************************************************//**
  * \brief Sends a character. Please make sure there is room in the transmit
@@ -134,7 +165,61 @@ void uart_init(void);
  *
  * \return Received character.
  ****************************************************************************/
+#if MEGAWIFI_HINT_DRAIN == 1
+#define uart_getc()		(rx_ring.enabled ? uart_rx_ring_getc() : UART_RHR)
+
+/************************************************************************//**
+ * \brief Takes the next byte from the receive ring. Please make sure data is
+ *        available by calling uart_rx_ready() before using this function.
+ *
+ * \return Received character.
+ ****************************************************************************/
+static inline uint8_t uart_rx_ring_getc(void)
+{
+	uint16_t tail = rx_ring.tail;
+	uint8_t c = rx_ring.buf[tail];
+
+	rx_ring.tail = (tail + 1) & (UART_RX_RING_LEN - 1);
+	return c;
+}
+
+/************************************************************************//**
+ * \brief Moves the bytes waiting in the receive FIFO to the receive ring,
+ *        stopping early if the ring fills up (RTS then throttles the
+ *        sender as usual). Meant to be called periodically from an
+ *        interrupt handler, so the FIFO is emptied regardless of what the
+ *        main loop is doing.
+ ****************************************************************************/
+void uart_rx_drain(void);
+
+/************************************************************************//**
+ * \brief Switches receive reads between the receive ring and the UART FIFO.
+ *        Enable before uart_rx_drain() starts being called, and only
+ *        disable once it is no longer called and the ring is empty.
+ *
+ * \param[in] enable Non zero to read from the ring, zero to read the FIFO.
+ ****************************************************************************/
+void uart_rx_ring_enable(uint8_t enable);
+#else
 #define uart_getc()		(UART_RHR)
+#endif
+
+#ifdef MW_HOST
+/// Host builds move the data through the MegaWiFi stand-in instead.
+int uart_host_tx_ready(void);
+int uart_host_rx_ready(void);
+void uart_host_putc(uint8_t c);
+uint8_t uart_host_getc(void);
+
+#undef uart_tx_ready
+#undef uart_rx_ready
+#undef uart_putc
+#undef uart_getc
+#define uart_tx_ready()		uart_host_tx_ready()
+#define uart_rx_ready()		uart_host_rx_ready()
+#define uart_putc(c)		do{uart_host_putc(c);}while(0);
+#define uart_getc()		uart_host_getc()
+#endif
 
 /************************************************************************//**
  * \brief Sets a value in IER, FCR, LCR or MCR register.
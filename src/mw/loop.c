@@ -5,40 +5,39 @@
 #include <stdint.h>
 #include <types.h>
 
-#include <setjmp.h>
-
 #include <memory.h>
 
 #include "loop.h"
 #include "mpool.h"
-#include <setjmp.h>
 #include <vstring.h>
 
+#ifdef MW_HOST
+/// Host builds derive the VDP status from the wall clock (see tests/netbench)
+uint16_t loop_host_vdp_status(void);
+#define VDP_CTRL_PORT_W loop_host_vdp_status()
+#else
 /// VDP Control port address
 #define VDP_CTRL_PORT_ADDR 0xC00004
 /// VDP control port, WORD access.
 #define VDP_CTRL_PORT_W (*((volatile uint16_t*)VDP_CTRL_PORT_ADDR))
+#endif
 /// Flag of the status register corresponging to the VBLANK interval.
 #define VDP_STAT_VBLANK 0x0008
 
 enum loop_check { LOOP_CHECK_FUNCS = 0, LOOP_CHECK_TIMERS };
 
-struct pend_env {
-    struct loop_func* f;
-    struct loop_timer* t;
-};
-
 struct loop_data {
     struct loop_func** f;
     struct loop_timer** t;
-    struct pend_env* env;
-    jmp_buf* jmp;
     enum loop_check check;
     int8_t func_max;
     int8_t timer_max;
     int8_t idx;
     int8_t vblank;
+    int8_t running;
+    int8_t posted;
     uint16_t frame;
+    int post_value;
     int exit;
 };
 
@@ -169,7 +168,6 @@ static void run_funcs(void)
             d->idx++;
             if (!f->disabled && !f->blocked) {
                 f->func_cb(f);
-                d->env->f = NULL;
             }
         }
     }
@@ -195,7 +193,6 @@ static void update_timer(struct loop_timer* t)
                 t->frames = 0;
             }
             t->timer_cb(t);
-            d->env->t = NULL;
         }
     }
 }
@@ -215,22 +212,25 @@ static void check_timers(void)
     }
 }
 
-int loop(void)
+static void loop_iterate(void)
 {
-    struct pend_env env = {};
-    d->env = &env;
+    if (frame_update()) {
+        d->check = LOOP_CHECK_TIMERS;
+        check_timers();
+    } else {
+        d->check = LOOP_CHECK_FUNCS;
+        run_funcs();
+    }
+    d->idx = 0;
+}
 
+int loop(void)
+{
+    d->running = TRUE;
     while (!d->exit) {
-        if (LOOP_CHECK_TIMERS == d->check || frame_update()) {
-            d->check = LOOP_CHECK_TIMERS;
-            check_timers();
-            d->idx = 0;
-            d->check = LOOP_CHECK_FUNCS;
-        } else {
-            run_funcs();
-            d->idx = 0;
-        }
+        loop_iterate();
     }
+    d->running = FALSE;
 
     return d->exit;
 }
@@ -244,54 +244,52 @@ void loop_deinit(void)
     d = NULL;
 }
 
-static int jmp_set(void)
-{
-    jmp_buf jmp;
-    int returned;
-    struct pend_env* prev_env = d->env;
-    jmp_buf* prev_jmp = d->jmp;
-
-    d->jmp = &jmp;
-
-    returned = setjmp(jmp);
-    if (!returned) {
-        loop();
-    }
-    d->env = prev_env;
-    d->jmp = prev_jmp;
-
-    return returned;
-}
-
+/// Waits are a nested run of the loop until loop_post() is called, so no
+/// execution context has to be saved. This spins on the loop, so it still
+/// blocks the scheduler. The caller (if it is a loop function or timer) is
+/// blocked meanwhile so it cannot be re-entered.
 int loop_pend(void)
 {
-    int returned = 0;
-
-    if (!d->env->f && !d->env->t) {
-        if (LOOP_CHECK_FUNCS == d->check) {
-            d->env->f = d->f[d->idx - 1];
+    struct loop_func* f = NULL;
+    struct loop_timer* t = NULL;
+    enum loop_check check = d->check;
+    int8_t idx = d->idx;
+    int8_t running = d->running;
+
+    if (running && idx > 0) {
+        if (LOOP_CHECK_FUNCS == check) {
+            f = d->f[idx - 1];
+            f->blocked = 1;
         } else {
-            d->env->t = d->t[d->idx - 1];
+            t = d->t[idx - 1];
+            t->blocked = 1;
         }
     }
-    if (d->env->f) {
-        d->env->f->blocked = 1;
-        returned = jmp_set();
-        d->env->f->blocked = 0;
-    } else if (d->env->t) {
-        d->env->t->blocked = 1;
-        returned = jmp_set();
-        d->env->t->blocked = 0;
+
+    d->running = TRUE;
+    d->posted = FALSE;
+    d->idx = 0;
+    while (!d->posted && !d->exit) {
+        loop_iterate();
+    }
+    d->posted = FALSE;
+    d->running = running;
+    d->idx = idx;
+    d->check = check;
+
+    if (f) {
+        f->blocked = 0;
+    } else if (t) {
+        t->blocked = 0;
     }
 
-    return returned;
+    return d->post_value;
 }
 
 void loop_post(int return_value)
 {
-    if (d->env) {
-        longjmp(*d->jmp, return_value);
-    }
+    d->post_value = return_value;
+    d->posted = TRUE;
 }
 
 void loop_end(int return_value)
@@ -9,17 +9,19 @@
  * \brief Loop handling for single threaded Megadrive programs.
  *
  * Allows easily adding and removing functions to be run on the main loop, as
- * well as timers based on the frame counter. It also provides a hacky
+ * well as timers based on the frame counter. It also provides an
  * interface to perform pseudo syncrhonous calls (through the loop_pend() and
- * loop_post() semantics) without disturbing the loop execution.
+ * loop_post() semantics) without disturbing the loop execution. A pending
+ * call runs the loop nested on the caller's stack until loop_post() is
+ * called, no execution context is saved or restored. The caller is still
+ * blocked meanwhile, so scheduler tasks must send commands and wait for the
+ * reply with PT_WAIT_UNTIL() instead of using the blocking mw_* calls.
  *
  * \note Timers will take more frames than expected if loop load is high
  * enough to take more than a frame to complete.
- * \warning Due to the crappy/hacky implementation of the syncrhonous API, when
- * nesting loop_pend() calls, loop_post() will restore control flow reversing
- * the order of the loop_pend() calls. This is probably not what you want, and
- * it is thus discouraged to nest loop_pend() calls unless you know what you
- * are doing.
+ * \warning When nesting loop_pend() calls, loop_post() always completes the
+ * innermost one. It is thus discouraged to nest loop_pend() calls unless you
+ * know what you are doing.
  ****************************************************************************/
 
 #include <stdint.h>
@@ -194,6 +196,8 @@ void loop_deinit(void);
  *
  * While in this function, the loop continues to run, and other functions and
  * timers are normally run. Use with care, specially if you are low on stack.
+ * Nothing outside the loop runs until it returns, so this is a busy wait as
+ * far as the rest of the program is concerned.
  *
  * \return A non-zero value, passed to the loop_post() function causing this
  * function to return, or zero on error.
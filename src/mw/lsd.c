@@ -105,9 +105,21 @@ static void recv_complete(void)
     }
 }
 
+/// Payload fast path: stores the byte already read and then copies any
+/// further bytes waiting in the UART FIFO, up to the end of the frame or
+/// the end of the buffer, without going back through the state machine.
 static void recv_add(uint8_t recv)
 {
-    d.rx.buf[d.rx.pos++] = recv;
+    char* buf = d.rx.buf;
+    int16_t pos = d.rx.pos;
+    int16_t end = d.rx.frame_len < d.rx.max ? d.rx.frame_len : d.rx.max;
+
+    buf[pos++] = recv;
+    while (pos < end && uart_rx_ready()) {
+        buf[pos++] = uart_getc();
+    }
+    d.rx.pos = pos;
+
     if (d.rx.pos >= d.rx.frame_len) {
         d.rx.stat = LSD_RECV_ETX;
     } else if (d.rx.pos >= d.rx.max) {
@@ -243,6 +243,17 @@ enum mw_err mw_send_sync(
     return MW_ERR_NONE;
 }
 
+void mw_start(void)
+{
+    uart_reset_fifos();
+    mw_module_start();
+}
+
+void mw_reset_fifos(void)
+{
+    uart_reset_fifos();
+}
+
 enum mw_err mw_detect(uint8_t* major, uint8_t* minor, char** variant)
 {
     int retries = 5;
@@ -666,7 +677,9 @@ static int fill_addr(const char* dst_addr, const char* dst_port,
     // Zero structure data
     memset(in_addr, 0, sizeof(struct mw_msg_in_addr));
     in_addr->dst_addr[0] = '\0';
-    v_strcpy(in_addr->dst_port, dst_port);
+    if (dst_port) {
+        v_strcpy(in_addr->dst_port, dst_port);
+    }
     if (src_port) {
         v_strcpy(in_addr->src_port, src_port);
     }
@@ -175,6 +175,22 @@ void mw_cmd_data_cb_set(lsd_recv_cb cmd_recv_cb);
  ****************************************************************************/
 enum mw_err mw_detect(uint8_t* major, uint8_t* minor, char** variant);
 
+/************************************************************************/ /**
+ * \brief Takes the WiFi module out of reset and returns without waiting.
+ *
+ * Non-blocking alternative to the startup part of mw_detect(). The caller
+ * must keep the module in reset for 30 ms after mw_init() before calling
+ * this, then allow it about a second to boot before sending commands.
+ ****************************************************************************/
+void mw_start(void);
+
+/************************************************************************/ /**
+ * \brief Resets the UART FIFOs, discarding any partially received reply.
+ *
+ * Used between the version probes that replace mw_detect().
+ ****************************************************************************/
+void mw_reset_fifos(void);
+
 /************************************************************************/ /**
  * \brief Obtain module version numbers and string
  *
@@ -9,19 +9,30 @@
 
 #define MP_ALIGN_MASK (MP_ALIGN - 1)
 
-/// BSS end symbol, defined in linker script. Pool grows from here to the
-/// end of the RAM
+#if defined(UNIT_TESTS) || defined(MW_HOST)
+/// Host builds have no linker provided free RAM, so use a static region
+static uint8_t mp_test_pool[0x10000];
+#define MP_POOL_START (mp_test_pool)
+#define MP_POOL_END ((void*)(mp_test_pool + sizeof(mp_test_pool)))
+#else
+/// Pool region reserved in the linker script, between the end of the BSS
+/// and the start of the SGDK heap
 extern uint8_t _eflash;
+extern uint8_t _bend;
+
+/// Start of the memory POOL
+#define MP_POOL_START (&_eflash)
 
 /// End of the memory POOL
-#define MP_POOL_END ((void*)0x01000000)
+#define MP_POOL_END ((void*)&_bend)
+#endif
 
 /// Mask used for alignment computations
 #define MP_ALIGN_MASK (MP_ALIGN - 1)
 
 #define MP_ALIGN_COMP(addr)                                                    \
     (uint8_t*)((                                                               \
-        (((uint32_t)(addr)) + MP_ALIGN_MASK) & (~((uint32_t)MP_ALIGN_MASK))))
+        (((uintptr_t)(addr)) + MP_ALIGN_MASK) & (~((uintptr_t)MP_ALIGN_MASK))))
 
 typedef struct {
     uint8_t* floor;
@@ -36,7 +47,7 @@ void mp_init(int force_init)
 {
     if (!md.init_done || force_init) {
         // Ensure the origin is aligned and initialize current position
-        md.floor = MP_ALIGN_COMP(&_eflash);
+        md.floor = MP_ALIGN_COMP(MP_POOL_START);
         md.pos = md.floor;
         md.init_done = 1;
     }
@@ -77,3 +88,47 @@ void mp_free_to(void* pos)
         && (pos == MP_ALIGN_COMP(pos)))
         md.pos = pos;
 }
+
+int mp_block_pool_init(struct mp_block_pool* pool, void* base,
+    uint16_t block_len, uint16_t blocks)
+{
+    if (block_len < sizeof(void*)) {
+        return -1;
+    }
+    pool->base = base;
+    pool->block_len = block_len;
+    pool->blocks = blocks;
+    mp_block_pool_reset(pool);
+
+    return 0;
+}
+
+void mp_block_pool_reset(struct mp_block_pool* pool)
+{
+    pool->free = NULL;
+    // Link blocks from the last one, so the first block is allocated first
+    for (uint16_t i = pool->blocks; i > 0; i--) {
+        void** block = (void**)(pool->base + (i - 1) * pool->block_len);
+        *block = pool->free;
+        pool->free = block;
+    }
+}
+
+void* mp_block_alloc(struct mp_block_pool* pool)
+{
+    void** block = pool->free;
+
+    if (block) {
+        pool->free = *block;
+    }
+
+    return block;
+}
+
+void mp_block_free(struct mp_block_pool* pool, void* block)
+{
+    if (block) {
+        *(void**)block = pool->free;
+        pool->free = block;
+    }
+}
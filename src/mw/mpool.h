@@ -92,6 +92,57 @@ void *mp_calloc(uint16_t length) __attribute__((malloc));
  ****************************************************************************/
 void mp_free_to(void *pos);
 
+/// Fixed-size block pool, over memory supplied by the caller
+struct mp_block_pool {
+	uint8_t *base;		///< First block
+	void *free;		///< Head of the free block list
+	uint16_t block_len;	///< Length of each block
+	uint16_t blocks;	///< Number of blocks in the pool
+};
+
+/************************************************************************//**
+ * \brief Creates a pool of fixed-size blocks.
+ *
+ * Links blocks * block_len bytes starting at base in a free list, so blocks
+ * can then be allocated and freed in any order in constant time. The memory
+ * is owned by the caller (usually a static array) and must stay valid while
+ * the pool is in use.
+ *
+ * \param[out] pool      Block pool to initialize.
+ * \param[in]  base      Memory for the blocks, suitably aligned.
+ * \param[in]  block_len Length of each block.
+ * \param[in]  blocks    Number of blocks.
+ *
+ * \return 0 on success, or -1 if blocks are too short to hold a free list
+ * link.
+ ****************************************************************************/
+int mp_block_pool_init(struct mp_block_pool *pool, void *base,
+		uint16_t block_len, uint16_t blocks);
+
+/************************************************************************//**
+ * \brief Returns every block of a block pool to its free list.
+ *
+ * \param[in] pool Block pool to reset.
+ ****************************************************************************/
+void mp_block_pool_reset(struct mp_block_pool *pool);
+
+/************************************************************************//**
+ * \brief Allocates a block from a block pool.
+ *
+ * \param[in] pool Block pool to allocate from.
+ *
+ * \return Pointer to the block, or NULL if all blocks are in use.
+ ****************************************************************************/
+void *mp_block_alloc(struct mp_block_pool *pool);
+
+/************************************************************************//**
+ * \brief Returns a block to its block pool.
+ *
+ * \param[in] pool  Block pool the block was allocated from.
+ * \param[in] block Block to free. NULL is ignored.
+ ****************************************************************************/
+void mp_block_free(struct mp_block_pool *pool, void *block);
+
 /************************************************************************//**
  * \brief Frees all the memory previously requested. 
  *
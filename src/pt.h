@@ -0,0 +1,53 @@
+#pragma once
+#include <types.h>
+
+// Stackless cooperative threads in the style of protothreads. A thread is
+// a function taking its Pt state; waits return to the caller and resume at
+// the same line on the next call, so only the resume point is kept between
+// calls. Locals do not survive a wait, keep any state in statics instead.
+
+typedef struct Pt {
+    u16 line;
+} Pt;
+
+typedef enum PtResult { PT_WAITING, PT_ENDED } PtResult;
+
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define PT_FALLTHROUGH __attribute__((fallthrough))
+#else
+#define PT_FALLTHROUGH
+#endif
+
+#define PT_INIT(pt) ((pt)->line = 0)
+
+#define PT_BEGIN(pt)                                                           \
+    switch ((pt)->line) {                                                      \
+    case 0:
+
+#define PT_END(pt)                                                             \
+    }                                                                          \
+    (pt)->line = 0;                                                            \
+    return PT_ENDED
+
+#define PT_EXIT(pt)                                                            \
+    do {                                                                       \
+        (pt)->line = 0;                                                        \
+        return PT_ENDED;                                                       \
+    } while (0)
+
+#define PT_WAIT_UNTIL(pt, condition)                                           \
+    do {                                                                       \
+        (pt)->line = __LINE__;                                                 \
+        PT_FALLTHROUGH;                                                        \
+    case __LINE__:                                                             \
+        if (!(condition)) {                                                    \
+            return PT_WAITING;                                                 \
+        }                                                                      \
+    } while (0)
+
+#define PT_YIELD(pt)                                                           \
+    do {                                                                       \
+        (pt)->line = __LINE__;                                                 \
+        return PT_WAITING;                                                     \
+    case __LINE__:;                                                            \
+    } while (0)
@@ -1,17 +1,85 @@
 #include "rtpmidi.h"
 #include "comm_megawifi.h"
+#include "scheduler.h"
 #include "bits.h"
+#include "log.h"
 #include <stdbool.h>
 
 #define MIDI_SYSEX_START 0xF0
 #define MIDI_SYSEX_END 0xF7
-#define MIDI_RESET 0xFF
+#define MIDI_REALTIME 0xF8
+
+#define MAX_DELTA_TIME_LEN 4
 
 #define STATUS_UPPER(status) (status >> 4)
+#define STATUS_LOWER(status) (status & 0x0F)
+
+#define EVENT_NOTE_OFF 0x8
+#define EVENT_NOTE_ON 0x9
+#define EVENT_CC 0xB
+#define EVENT_PITCH_BEND 0xE
+
+#define MIDI_CHANNELS 16
+
+#define JOURNAL_HEADER_LEN 3
+#define JOURNAL_FLAG_SYSTEM 6
+#define JOURNAL_FLAG_CHANNELS 5
+#define SYSTEM_JOURNAL_HEADER_LEN 2
+#define CHANNEL_JOURNAL_HEADER_LEN 3
+#define CHAPTER_P 7
+#define CHAPTER_C 6
+#define CHAPTER_M 5
+#define CHAPTER_W 4
+#define CHAPTER_N 3
+#define CHAPTER_P_LEN 3
+#define CHAPTER_M_HEADER_LEN 2
+#define CHAPTER_W_LEN 2
+#define CHAPTER_N_HEADER_LEN 2
+#define CONTROLLER_LOG_LEN 2
+#define NOTE_LOG_LEN 2
+
+#define MAX_PENDING_EVENTS 64
+#define MAX_EVENT_DELAY 10000
+
+#define MAX_OUTPUT_LEN                                                         \
+    (COMM_MEGAWIFI_SEND_MAX_LEN - RTP_MIDI_HEADER_LEN                          \
+        - RTP_MIDI_COMMAND_SECTION_HEADER_MAX_LEN)
+#define MAX_OUTPUT_COMMAND_LEN 4
+#define MIDI_SYSEX_CANCEL 0xF4
+
+typedef struct PendingEvent {
+    u32 due;
+    u8 status;
+    u8 data[2];
+    u8 length;
+} PendingEvent;
+
+static u8 activeNotes[MIDI_CHANNELS][128 / 8];
+static PendingEvent pendingEvents[MAX_PENDING_EVENTS];
+static u8 pendingHead;
+static u8 pendingCount;
+
+static u16 lastJournalLength;
+
+static u8 outCommands[MAX_OUTPUT_LEN];
+static u16 outLength;
+static u8 outStatus;
+static u8 outRemaining;
+static bool outSysex;
+
+static bool isLongHeader(u8 flags)
+{
+    return CHECK_BIT(flags, 7);
+}
+
+static bool hasJournal(u8 flags)
+{
+    return CHECK_BIT(flags, 6);
+}
 
-static bool isLongHeader(u8* commandSection)
+static bool hasFirstDelta(u8 flags)
 {
-    return (u8)commandSection[0] >> 7;
+    return CHECK_BIT(flags, 5);
 }
 
 static u16 fourBitMidiLength(u8* commandSection)
@@ -21,46 +89,164 @@ static u16 fourBitMidiLength(u8* commandSection)
 
 static u16 twelveBitMidiLength(u8* commandSection)
 {
-    return (((u16)commandSection[0] << 12) + (u16)commandSection[1]);
+    return ((u16)(commandSection[0] & 0x0F) << 8) + commandSection[1];
 }
 
-static u8 bytesToEmit(u8 status)
+static u8 dataLength(u8 status)
 {
-    if (STATUS_UPPER(status) == 0xC || STATUS_UPPER(status) == 0xD
-        || status == 0xF1 || status == 0xF3) {
+    switch (STATUS_UPPER(status)) {
+    case 0xC:
+    case 0xD:
         return 1;
-    } else {
+    case 0xF:
+        if (status == 0xF1 || status == 0xF3) {
+            return 1;
+        } else if (status == 0xF2) {
+            return 2;
+        }
+        return 0;
+    default:
         return 2;
     }
 }
 
-static void emitMidiEvent(u8 status, u8** cursor)
+static bool isNoteActive(u8 chan, u8 pitch)
 {
-    comm_megawifi_midiEmitCallback(status);
-    u8 count = bytesToEmit(status);
-    for (u8 i = 0; i < count; i++) {
-        comm_megawifi_midiEmitCallback(**cursor);
-        if (i < count - 1) {
-            (*cursor)++;
-        }
-    };
+    return CHECK_BIT(activeNotes[chan][pitch >> 3], pitch & 7);
+}
+
+static void trackNoteState(u8 status, u8 pitch, u8 velocity)
+{
+    u8 chan = STATUS_LOWER(status);
+    u8 event = STATUS_UPPER(status);
+    if (event == EVENT_NOTE_ON && velocity != 0) {
+        SET_BIT(activeNotes[chan][pitch >> 3], (pitch & 7));
+    } else if (event == EVENT_NOTE_ON || event == EVENT_NOTE_OFF) {
+        CLEAR_BIT(activeNotes[chan][pitch >> 3], (pitch & 7));
+    }
+}
+
+static void emitMidiEvent(u8 status, u8* data, u8 length)
+{
+    if (length == 2) {
+        trackNoteState(status, data[0], data[1]);
+    }
+    comm_megawifi_midiEmit(status, data, length);
+}
+
+static bool isDue(u32 due, u32 now)
+{
+    return (s32)(due - now) <= 0;
+}
+
+static PendingEvent* pendingEventAt(u8 index)
+{
+    return &pendingEvents[(pendingHead + index) % MAX_PENDING_EVENTS];
+}
+
+static void emitEarliestPendingEvent(void)
+{
+    PendingEvent* event = pendingEventAt(0);
+    emitMidiEvent(event->status, event->data, event->length);
+    pendingHead = (pendingHead + 1) % MAX_PENDING_EVENTS;
+    pendingCount--;
+}
+
+static void emitEventsDueBy(u32 time)
+{
+    while (pendingCount != 0 && isDue(pendingEventAt(0)->due, time)) {
+        emitEarliestPendingEvent();
+    }
+}
+
+static void scheduleMidiEvent(u32 due, u8 status, u8* data, u8 length)
+{
+    if (pendingCount == 0 && isDue(due, scheduler_timestamp())) {
+        emitMidiEvent(status, data, length);
+        return;
+    }
+    if (pendingCount == MAX_PENDING_EVENTS) {
+        emitEarliestPendingEvent();
+    }
+    // Sessions are played out with their own delays, so keep the queue in
+    // due order rather than arrival order
+    u8 index = pendingCount;
+    while (index != 0 && !isDue(pendingEventAt(index - 1)->due, due)) {
+        *pendingEventAt(index) = *pendingEventAt(index - 1);
+        index--;
+    }
+    PendingEvent* event = pendingEventAt(index);
+    event->due = due;
+    event->status = status;
+    event->length = length;
+    for (u8 i = 0; i < length; i++) {
+        event->data[i] = data[i];
+    }
+    pendingCount++;
+}
+
+void rtpmidi_init(void)
+{
+    pendingHead = 0;
+    pendingCount = 0;
+    lastJournalLength = 0;
+    outLength = 0;
+    outStatus = 0;
+    outRemaining = 0;
+    outSysex = false;
 }
 
-static void processSysEx(u8** cursor)
+void rtpmidi_tick(void)
 {
-    do {
-        comm_megawifi_midiEmitCallback(**cursor);
-        (*cursor)++;
-    } while (!(**cursor == MIDI_SYSEX_END || **cursor == MIDI_SYSEX_START));
-    comm_megawifi_midiEmitCallback(MIDI_SYSEX_END);
+    if (pendingCount == 0) {
+        return;
+    }
+    emitEventsDueBy(scheduler_timestamp());
+}
+
+static void appendSysEx(RtpMidiSysEx* sysex, u8* data, u16 length)
+{
+    if (sysex->length + length > RTP_MIDI_MAX_SYSEX_LEN) {
+        log_warn("RTP: SysEx too long");
+        sysex->open = false;
+        return;
+    }
+    for (u16 i = 0; i < length; i++) {
+        sysex->data[sysex->length++] = data[i];
+    }
 }
 
-static void processMiddleSysEx(u8** cursor)
+static u8* processSysEx(
+    RtpMidiSysEx* sysex, u8 status, u8* cursor, u8* end, u32 due)
 {
-    // we're ignoring these for now...
-    do {
-        (*cursor)++;
-    } while (!(**cursor == MIDI_SYSEX_END || **cursor == MIDI_SYSEX_START));
+    u8* start = cursor;
+    while (cursor < end && !CHECK_BIT(*cursor, 7)) {
+        cursor++;
+    }
+    if (cursor == end) {
+        return end;
+    }
+    // Sysex is not queued, so only play out the events due before it
+    emitEventsDueBy(due);
+    u8 terminator = *cursor++;
+    if (status == MIDI_SYSEX_START) {
+        sysex->length = 0;
+        sysex->open = true;
+    } else if (!sysex->open) {
+        // continuation of a sysex whose first segment was not received
+        return cursor;
+    }
+    if (terminator != MIDI_SYSEX_START && terminator != MIDI_SYSEX_END) {
+        sysex->open = false;
+        return cursor;
+    }
+    appendSysEx(sysex, start, cursor - start - 1);
+    if (sysex->open && terminator == MIDI_SYSEX_END) {
+        sysex->data[sysex->length++] = MIDI_SYSEX_END;
+        comm_megawifi_midiEmit(MIDI_SYSEX_START, sysex->data, sysex->length);
+        sysex->open = false;
+    }
+    return cursor;
 }
 
 static u16 sequenceNumber(char* buffer)
@@ -68,46 +254,328 @@ static u16 sequenceNumber(char* buffer)
     return ((u8)buffer[2] << 8) + (u8)buffer[3];
 }
 
-static bool isFinalDeltaByte(u8 value)
+static u8* readDeltaTime(u8* cursor, u8* end, u32* delta)
 {
-    return !CHECK_BIT(value, 7);
+    *delta = 0;
+    for (u8 i = 0; i < MAX_DELTA_TIME_LEN && cursor < end; i++) {
+        u8 value = *cursor++;
+        *delta = (*delta << 7) + (value & 0x7F);
+        if (!CHECK_BIT(value, 7)) {
+            return cursor;
+        }
+    }
+    return NULL;
 }
 
-mw_err rtpmidi_processRtpMidiPacket(char* buffer, u16 length, u16* lastSeqNum)
+static void processCommandList(RtpMidiSysEx* sysex, u8* cursor, u8* end,
+    bool firstDelta, u32 playout)
 {
-    (void)length; // TODO: Probably shouldn't ignore length...
-    u16 seqNum = sequenceNumber(buffer);
+    u8 runningStatus = 0;
+    bool readDelta = firstDelta;
+    u32 offset = 0;
+    while (cursor < end) {
+        if (readDelta) {
+            u32 delta;
+            cursor = readDeltaTime(cursor, end, &delta);
+            if (cursor == NULL || cursor == end) {
+                return;
+            }
+            offset += delta;
+            if (offset > MAX_EVENT_DELAY) {
+                offset = MAX_EVENT_DELAY;
+            }
+        }
+        readDelta = true;
+
+        u8 status = *cursor;
+        if (CHECK_BIT(status, 7)) {
+            cursor++;
+        } else if (runningStatus != 0) {
+            status = runningStatus;
+        } else {
+            return;
+        }
+
+        if (status == MIDI_SYSEX_START || status == MIDI_SYSEX_END) {
+            cursor
+                = processSysEx(sysex, status, cursor, end, playout + offset);
+            runningStatus = 0;
+            continue;
+        }
+        if (status >= MIDI_REALTIME) {
+            scheduleMidiEvent(playout + offset, status, NULL, 0);
+            continue;
+        }
+        u8 length = dataLength(status);
+        if (cursor + length > end) {
+            return;
+        }
+        runningStatus = status < 0xF0 ? status : 0;
+        scheduleMidiEvent(playout + offset, status, cursor, length);
+        cursor += length;
+    }
+}
+
+static u16 tenBitLength(u8* header)
+{
+    return ((u16)(header[0] & 0x03) << 8) + header[1];
+}
+
+static void emitRecoveredEvent(u8 status, u8 data1, u8 data2)
+{
+    u8 data[2] = { data1, data2 };
+    emitMidiEvent(status, data, sizeof(data));
+}
+
+static void recoverControllers(u8 chan, u8* cursor, u8* end)
+{
+    u8 count = (cursor[0] & 0x7F) + 1;
+    cursor++;
+    while (count-- && cursor + CONTROLLER_LOG_LEN <= end) {
+        if (!CHECK_BIT(cursor[1], 7)) {
+            emitRecoveredEvent(
+                (EVENT_CC << 4) | chan, cursor[0] & 0x7F, cursor[1]);
+        }
+        cursor += CONTROLLER_LOG_LEN;
+    }
+}
+
+static u8* skipControllers(u8* cursor)
+{
+    return cursor + 1 + ((cursor[0] & 0x7F) + 1) * CONTROLLER_LOG_LEN;
+}
+
+static void recoverPitchWheel(u8 chan, u8* cursor)
+{
+    emitRecoveredEvent(
+        (EVENT_PITCH_BEND << 4) | chan, cursor[0] & 0x7F, cursor[1] & 0x7F);
+}
+
+static void recoverNotes(u8 chan, u8* cursor, u8* end)
+{
+    u16 count = cursor[0] & 0x7F;
+    u8 low = cursor[1] >> 4;
+    u8 high = cursor[1] & 0x0F;
+    if (count == 127 && low == 15 && high == 0) {
+        count = 128;
+    }
+    cursor += CHAPTER_N_HEADER_LEN;
+    for (; count != 0 && cursor + NOTE_LOG_LEN <= end; count--) {
+        u8 pitch = cursor[0] & 0x7F;
+        bool playRecommended = CHECK_BIT(cursor[1], 7);
+        if (playRecommended && !isNoteActive(chan, pitch)) {
+            emitRecoveredEvent(
+                (EVENT_NOTE_ON << 4) | chan, pitch, cursor[1] & 0x7F);
+        }
+        cursor += NOTE_LOG_LEN;
+    }
+    if (count != 0) {
+        return;
+    }
+    for (u8 octet = low; octet <= high && cursor < end; octet++, cursor++) {
+        for (u8 bit = 0; bit < 8; bit++) {
+            u8 pitch = (octet << 3) + bit;
+            if (CHECK_BIT(*cursor, 7 - bit) && isNoteActive(chan, pitch)) {
+                emitRecoveredEvent((EVENT_NOTE_OFF << 4) | chan, pitch, 0);
+            }
+        }
+    }
+}
+
+static void recoverChannel(u8* cursor, u8* end)
+{
+    u8 chan = (cursor[0] >> 3) & 0x0F;
+    u8 chapters = cursor[2];
+    cursor += CHANNEL_JOURNAL_HEADER_LEN;
+
+    if (CHECK_BIT(chapters, CHAPTER_P)) {
+        cursor += CHAPTER_P_LEN;
+    }
+    if (CHECK_BIT(chapters, CHAPTER_C)) {
+        if (cursor >= end) {
+            return;
+        }
+        recoverControllers(chan, cursor, end);
+        cursor = skipControllers(cursor);
+    }
+    if (CHECK_BIT(chapters, CHAPTER_M)) {
+        if (cursor + CHAPTER_M_HEADER_LEN > end) {
+            return;
+        }
+        cursor += tenBitLength(cursor);
+    }
+    if (CHECK_BIT(chapters, CHAPTER_W)) {
+        if (cursor + CHAPTER_W_LEN > end) {
+            return;
+        }
+        recoverPitchWheel(chan, cursor);
+        cursor += CHAPTER_W_LEN;
+    }
+    if (CHECK_BIT(chapters, CHAPTER_N)) {
+        if (cursor + CHAPTER_N_HEADER_LEN > end) {
+            return;
+        }
+        recoverNotes(chan, cursor, end);
+    }
+}
+
+static void processJournal(u8* cursor, u8* end)
+{
+    if (cursor + JOURNAL_HEADER_LEN > end) {
+        return;
+    }
+    u8 flags = cursor[0];
+    u8 channels = (flags & 0x0F) + 1;
+    cursor += JOURNAL_HEADER_LEN;
+
+    if (CHECK_BIT(flags, JOURNAL_FLAG_SYSTEM)) {
+        if (cursor + SYSTEM_JOURNAL_HEADER_LEN > end) {
+            return;
+        }
+        cursor += tenBitLength(cursor);
+    }
+    if (!CHECK_BIT(flags, JOURNAL_FLAG_CHANNELS)) {
+        return;
+    }
+    while (channels-- && cursor + CHANNEL_JOURNAL_HEADER_LEN <= end) {
+        u16 channelLength = tenBitLength(cursor);
+        if (channelLength < CHANNEL_JOURNAL_HEADER_LEN
+            || cursor + channelLength > end) {
+            return;
+        }
+        recoverChannel(cursor, cursor + channelLength);
+        cursor += channelLength;
+    }
+}
+
+static s16 sequenceDistance(u16 seqNum, RtpMidiSequence* sequence)
+{
+    return sequence->received ? (s16)(seqNum - sequence->last) : 1;
+}
+
+u16 rtpmidi_lastJournalLength(void)
+{
+    return lastJournalLength;
+}
+
+mw_err rtpmidi_processRtpMidiPacket(char* buffer, u16 length,
+    RtpMidiSequence* sequence, RtpMidiSysEx* sysex, u32 playout)
+{
+    if (length <= RTP_MIDI_HEADER_LEN) {
+        return ERR_RTP_MIDI_PKT_TOO_SMALL;
+    }
     u8* commandSection = (u8*)&buffer[RTP_MIDI_HEADER_LEN];
-    bool longHeader = isLongHeader(commandSection);
+    u8* end = (u8*)buffer + length;
+    u8 flags = commandSection[0];
+    bool longHeader = isLongHeader(flags);
+    if (longHeader && commandSection + 2 > end) {
+        return ERR_RTP_MIDI_PKT_TOO_SMALL;
+    }
     u16 midiLength = longHeader ? twelveBitMidiLength(commandSection)
                                 : fourBitMidiLength(commandSection);
     u8* midiStart = &commandSection[longHeader ? 2 : 1];
-    u8* midiEnd = midiStart + (midiLength - 1);
-    u8 status = 0;
-    u8* cursor = midiStart;
-
-    bool walkingOverDeltas = false;
-    while (cursor <= midiEnd) {
-        if (walkingOverDeltas && isFinalDeltaByte(*cursor)) {
-            walkingOverDeltas = false;
-        } else if (*cursor == MIDI_SYSEX_START) {
-            processSysEx(&cursor);
-            walkingOverDeltas = true;
-        } else if (*cursor == MIDI_SYSEX_END) {
-            processMiddleSysEx(&cursor);
-            walkingOverDeltas = true;
-        } else if (*cursor == MIDI_RESET) {
-            comm_megawifi_midiEmitCallback(*cursor);
-            walkingOverDeltas = true;
-        } else if (CHECK_BIT(*cursor, 7)) { // status bit present
-            status = *cursor;
-        } else {
-            emitMidiEvent(status, &cursor);
-            walkingOverDeltas = true;
-        }
-        cursor++;
+    if (midiLength > end - midiStart) {
+        return ERR_RTP_MIDI_PKT_TOO_SMALL;
     }
+    u8* midiEnd = midiStart + midiLength;
 
-    *lastSeqNum = seqNum;
+    u16 seqNum = sequenceNumber(buffer);
+    lastJournalLength = hasJournal(flags) ? end - midiEnd : 0;
+    s16 distance = sequenceDistance(seqNum, sequence);
+    if (distance <= 0) {
+        // duplicate or late; its commands were already recovered or played
+        return MW_ERR_NONE;
+    }
+    bool gap = distance > 1;
+    if (sysex->open && gap) {
+        log_warn("RTP: SysEx segment lost");
+        sysex->open = false;
+    }
+    if (hasJournal(flags) && gap) {
+        emitEventsDueBy(playout);
+        processJournal(midiEnd, end);
+    }
+    processCommandList(
+        sysex, midiStart, midiEnd, hasFirstDelta(flags), playout);
+
+    sequence->last = seqNum;
+    sequence->received = true;
     return MW_ERR_NONE;
 }
+
+static void appendOutput(u8 data)
+{
+    outCommands[outLength++] = data;
+}
+
+static void startOutputCommand(u8 status)
+{
+    if (outLength != 0) {
+        appendOutput(0); // delta time
+    }
+    appendOutput(status);
+}
+
+bool rtpmidi_canWrite(void)
+{
+    if (outRemaining != 0) {
+        return true;
+    }
+    // room for a whole command, plus a sysex segment terminator or cancel
+    return outLength + MAX_OUTPUT_COMMAND_LEN + outSysex <= MAX_OUTPUT_LEN;
+}
+
+static void writeSysEx(u8 data)
+{
+    if (outLength == 0) {
+        appendOutput(MIDI_SYSEX_END); // continues a segment from last packet
+    }
+    appendOutput(data);
+    if (data == MIDI_SYSEX_END) {
+        outSysex = false;
+    }
+}
+
+void rtpmidi_write(u8 data)
+{
+    if (outSysex) {
+        if (!CHECK_BIT(data, 7) || data == MIDI_SYSEX_END
+            || data >= MIDI_REALTIME) {
+            writeSysEx(data);
+            return;
+        }
+        writeSysEx(MIDI_SYSEX_CANCEL);
+        outSysex = false;
+    }
+    if (CHECK_BIT(data, 7)) {
+        startOutputCommand(data);
+        if (data >= MIDI_REALTIME) {
+            return;
+        }
+        outSysex = data == MIDI_SYSEX_START;
+        outStatus = data < 0xF0 ? data : 0;
+        outRemaining = outSysex ? 0 : dataLength(data);
+        return;
+    }
+    if (outRemaining == 0) {
+        if (outStatus == 0) {
+            return;
+        }
+        startOutputCommand(outStatus);
+        outRemaining = dataLength(outStatus);
+    }
+    appendOutput(data);
+    outRemaining--;
+}
+
+void rtpmidi_flush(void)
+{
+    if (outLength == 0 || outRemaining != 0) {
+        return;
+    }
+    if (outSysex) {
+        appendOutput(MIDI_SYSEX_START); // segment continues in next packet
+    }
+    applemidi_sendMidi(outCommands, outLength);
+    outLength = 0;
+}
@@ -1,4 +1,31 @@
 #pragma once
 #include "applemidi.h"
 
-mw_err rtpmidi_processRtpMidiPacket(char* buffer, u16 length, u16* lastSeqNum);
+#define RTP_MIDI_MAX_SYSEX_LEN 256
+
+// A sysex segmented across packets is reassembled here, one per session
+typedef struct RtpMidiSysEx {
+    u8 data[RTP_MIDI_MAX_SYSEX_LEN + 1];
+    u16 length;
+    bool open;
+} RtpMidiSysEx;
+
+// Sequence number of the last packet received from a session
+typedef struct RtpMidiSequence {
+    u16 last;
+    bool received;
+} RtpMidiSequence;
+
+void rtpmidi_init(void);
+// Events are scheduled relative to the playout time, in scheduler_timestamp()
+// units, offset by the delta times of the command list.
+mw_err rtpmidi_processRtpMidiPacket(char* buffer, u16 length,
+    RtpMidiSequence* sequence, RtpMidiSysEx* sysex, u32 playout);
+void rtpmidi_tick(void);
+u16 rtpmidi_lastJournalLength(void);
+
+// Outgoing MIDI bytes are gathered into a command list which is sent to
+// all sessions as one RTP-MIDI packet by rtpmidi_flush().
+bool rtpmidi_canWrite(void);
+void rtpmidi_write(u8 data);
+void rtpmidi_flush(void);
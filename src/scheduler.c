@@ -1,21 +1,37 @@
 #include "scheduler.h"
 #include "everdrive_led.h"
+#include "midi_bundle.h"
 #include "midi_psg.h"
 #include "ui.h"
 #include "midi_receiver.h"
 #include "comm_megawifi.h"
+#include "comm.h"
+#include "region.h"
+#include "log.h"
 #include <stdint.h>
 #include <types.h>
 
 static u16 previousFrame;
 static volatile u16 frame;
 static u16 ticks;
+static u32 frameTimestamp;
+static u16 ticksThisFrame;
+static u16 ticksLastFrame;
+static SchedulerTask* tasks[MAX_SCHEDULER_TASKS];
+static u8 taskCount;
+
+#define NTSC_FRAME_DURATION 167
+#define PAL_FRAME_DURATION 200
 
 void scheduler_init(void)
 {
     previousFrame = 0;
     frame = 0;
     ticks = 0;
+    frameTimestamp = 0;
+    ticksThisFrame = 0;
+    ticksLastFrame = 0;
+    taskCount = 0;
 }
 
 void scheduler_vsync(void)
@@ -23,6 +39,18 @@ void scheduler_vsync(void)
     frame++;
 }
 
+static u16 frameDuration(void)
+{
+    return region_isPal() ? PAL_FRAME_DURATION : NTSC_FRAME_DURATION;
+}
+
+static void advanceTimestamp(void)
+{
+    frameTimestamp += (u32)frameDuration() * (u16)(frame - previousFrame);
+    ticksLastFrame = ticksThisFrame;
+    ticksThisFrame = 0;
+}
+
 static void onFrame(void)
 {
     midi_psg_tick();
@@ -36,17 +64,65 @@ u16 scheduler_ticks(void)
     return ticks;
 }
 
+u32 scheduler_timestamp(void)
+{
+    if (ticksLastFrame == 0) {
+        return frameTimestamp;
+    }
+    u16 duration = frameDuration();
+    u32 offset = (u32)ticksThisFrame * duration / ticksLastFrame;
+    if (offset >= duration) {
+        offset = duration - 1;
+    }
+    return frameTimestamp + offset;
+}
+
+void scheduler_addTask(SchedulerTask* task)
+{
+    if (taskCount == MAX_SCHEDULER_TASKS) {
+        log_warn("Scheduler: Too many tasks");
+        return;
+    }
+    PT_INIT(&task->pt);
+    tasks[taskCount++] = task;
+}
+
+static void removeTask(u8 index)
+{
+    taskCount--;
+    for (u8 i = index; i < taskCount; i++) {
+        tasks[i] = tasks[i + 1];
+    }
+}
+
+static void runTasks(void)
+{
+    u8 i = 0;
+    while (i < taskCount) {
+        SchedulerTask* task = tasks[i];
+        if (task->run(&task->pt) == PT_ENDED) {
+            removeTask(i);
+        } else {
+            i++;
+        }
+    }
+}
+
 static void onTick(void)
 {
     ticks++;
-    comm_megawifi_tick();
+    ticksThisFrame++;
+    runTasks();
+    midi_bundle_tick();
     midi_receiver_readIfCommReady();
+    comm_flush();
 }
 
 void scheduler_tick(void)
 {
     onTick();
     if (frame != previousFrame) {
+        advanceTimestamp();
         onFrame();
         previousFrame = frame;
     }
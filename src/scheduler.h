@@ -1,9 +1,24 @@
 #pragma once
+#include "pt.h"
 #include <stdint.h>
 #include <types.h>
 
+#define MAX_SCHEDULER_TASKS 4
+
+typedef struct SchedulerTask SchedulerTask;
+
+struct SchedulerTask {
+    PtResult (*run)(Pt* pt);
+    Pt pt;
+};
+
 void scheduler_init(void);
 void scheduler_vsync(void);
 void scheduler_tick(void);
 void scheduler_run(void);
 u16 scheduler_ticks(void);
+void scheduler_addTask(SchedulerTask* task);
+
+// Time elapsed since init in 100 us units (the RTP-MIDI 10 kHz clock),
+// interpolated within a frame from the tick rate of the previous frame
+u32 scheduler_timestamp(void);
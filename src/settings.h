@@ -9,5 +9,16 @@ bool settings_isMegaWiFiRom(void);
 #define COMM_MEGAWIFI 1
 
 #define DEBUG_MEGAWIFI_SEND 0
+
+// Drain the MegaWiFi UART from the VDP H-int every N scanlines instead of
+// only from the main loop. There are no H-ints in vertical blanking, so
+// RTS flow control still pauses the module for part of each frame.
+#define MEGAWIFI_HINT_DRAIN 0
+#define MEGAWIFI_HINT_DRAIN_LINES 2
+
+// Also receive plain MIDI datagrams on ipMIDI port 1 (UDP 21928), with no
+// session handshake. The module cannot join multicast groups, so senders
+// must reach it by unicast or subnet broadcast.
+#define MEGAWIFI_IPMIDI 0
 // #define DEBUG_TICKS
 // #define DEBUG_EVENTS
@@ -60,18 +60,18 @@ void expect_synth_volume(u8 channel, u8 volume);
 
 #define expect_midi_emit(mb)                                                   \
     {                                                                          \
-        expect_value(__wrap_comm_megawifi_midiEmitCallback, midiByte, mb);     \
+        expect_value(mock_comm_megawifi_midiEmitByte, midiByte, mb);           \
     }
 
 #define expect_midi_emit_trio(mb1, mb2, mb3)                                   \
     {                                                                          \
-        expect_value(__wrap_comm_megawifi_midiEmitCallback, midiByte, mb1);    \
-        expect_value(__wrap_comm_megawifi_midiEmitCallback, midiByte, mb2);    \
-        expect_value(__wrap_comm_megawifi_midiEmitCallback, midiByte, mb3);    \
+        expect_value(mock_comm_megawifi_midiEmitByte, midiByte, mb1);          \
+        expect_value(mock_comm_megawifi_midiEmitByte, midiByte, mb2);          \
+        expect_value(mock_comm_megawifi_midiEmitByte, midiByte, mb3);          \
     }
 
 #define expect_midi_emit_duo(mb1, mb2)                                         \
     {                                                                          \
-        expect_value(__wrap_comm_megawifi_midiEmitCallback, midiByte, mb1);    \
-        expect_value(__wrap_comm_megawifi_midiEmitCallback, midiByte, mb2);    \
+        expect_value(mock_comm_megawifi_midiEmitByte, midiByte, mb1);          \
+        expect_value(mock_comm_megawifi_midiEmitByte, midiByte, mb2);          \
     }
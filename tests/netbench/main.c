@@ -0,0 +1,177 @@
+#define _DEFAULT_SOURCE
+#include "buffer.h"
+#include "comm_megawifi.h"
+#include "log.h"
+#include "mw_standin.h"
+#include "scheduler.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Runs the firmware's MegaWiFi, AppleMIDI and RTP-MIDI code against the
+// module stand-in, so a Linux AppleMIDI sender can be pointed at UDP 5006
+// and the receive path measured. Stats are printed once a second.
+
+#define FRAMES_PER_REPORT 60
+#define TIMESTAMP_NS 100000
+
+typedef struct Counters Counters;
+
+struct Counters {
+    u32 ticks;
+    uint64_t busyNanos;
+    uint64_t maxTickNanos;
+    u32 midiBytes;
+    u32 midiMessages;
+    StandinStats standin;
+};
+
+static SchedulerTask* megawifiTask;
+static volatile sig_atomic_t stopRequested;
+static Counters total;
+static Counters lastReport;
+static uint64_t peakTickNanos;
+
+void scheduler_addTask(SchedulerTask* task)
+{
+    megawifiTask = task;
+}
+
+u32 scheduler_timestamp(void)
+{
+    return standin_nanos() / TIMESTAMP_NS;
+}
+
+static void onSignal(int signal)
+{
+    (void)signal;
+    stopRequested = 1;
+}
+
+static void printLogs(void)
+{
+    Log* log;
+    while ((log = log_dequeue()) != NULL) {
+        fprintf(stderr, "%s %.*s\n", log->level == Warn ? "WARN" : "INFO",
+            log->msgLen, log->msg);
+    }
+}
+
+static void runTask(void)
+{
+    u32 bytesBefore = standin_stats()->bytesToConsole;
+    uint64_t before = standin_nanos();
+    megawifiTask->run(&megawifiTask->pt);
+    uint64_t elapsed = standin_nanos() - before;
+
+    total.ticks++;
+    if (standin_stats()->bytesToConsole != bytesBefore) {
+        total.busyNanos += elapsed;
+    }
+    if (elapsed > total.maxTickNanos) {
+        total.maxTickNanos = elapsed;
+    }
+    if (elapsed > peakTickNanos) {
+        peakTickNanos = elapsed;
+    }
+}
+
+static void drainMidi(void)
+{
+    while (comm_megawifi_readReady()) {
+        u8 data = comm_megawifi_read();
+        total.midiBytes++;
+        if ((data & 0x80) && data != 0xF7) {
+            total.midiMessages++;
+        }
+    }
+}
+
+static void printReport(const Counters* from, const Counters* to, u32 frames)
+{
+    double seconds = (double)frames / 60;
+    u32 packets = to->standin.rtpIn - from->standin.rtpIn;
+    u32 datagrams = to->standin.udpIn - from->standin.udpIn;
+    double busyUs = (to->busyNanos - from->busyNanos) / 1000.0;
+    printf("%7.1f pkt/s  %5u lost  %7.1f msg/s  %6.1f us/pkt  "
+           "%7.1f ticks/s  max tick %6.1f us  backlog %u\n",
+        packets / seconds, to->standin.rtpLost - from->standin.rtpLost,
+        (to->midiMessages - from->midiMessages) / seconds,
+        datagrams ? busyUs / datagrams : 0.0,
+        (to->ticks - from->ticks) / seconds, to->maxTickNanos / 1000.0,
+        to->standin.maxBacklog);
+    fflush(stdout);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [-t seconds] [-u]\n"
+        "  -t  stop after the given number of seconds\n"
+        "  -u  do not throttle the pseudo-UART to the MegaWiFi baud rate\n",
+        name);
+}
+
+int main(int argc, char** argv)
+{
+    u32 duration = 0;
+    bool throttle = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:u")) != -1) {
+        switch (opt) {
+        case 't':
+            duration = atoi(optarg);
+            break;
+        case 'u':
+            throttle = false;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    standin_init(throttle);
+    log_init();
+    buffer_init();
+    comm_megawifi_init();
+    printLogs();
+    if (megawifiTask == NULL) {
+        fprintf(stderr, "netbench: MegaWiFi init failed\n");
+        return 1;
+    }
+
+    u32 startFrame = standin_frame();
+    u32 frame = startFrame;
+    u32 reportFrame = startFrame;
+    while (!stopRequested) {
+        u32 now = standin_frame();
+        if (now != frame) {
+            frame = now;
+            comm_megawifi_vsync();
+            if (frame - reportFrame >= FRAMES_PER_REPORT) {
+                total.standin = *standin_stats();
+                printReport(&lastReport, &total, frame - reportFrame);
+                lastReport = total;
+                total.maxTickNanos = 0;
+                reportFrame = frame;
+            }
+            if (duration && frame - startFrame >= duration * 60) {
+                break;
+            }
+        }
+        runTask();
+        drainMidi();
+        printLogs();
+    }
+
+    total.standin = *standin_stats();
+    total.maxTickNanos = peakTickNanos;
+    printf("total: ");
+    Counters zero = {};
+    printReport(&zero, &total, frame - startFrame);
+    return 0;
+}
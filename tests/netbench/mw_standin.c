@@ -0,0 +1,408 @@
+#define _DEFAULT_SOURCE
+#include "mw_standin.h"
+#include "mw/megawifi.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LSD_STX_ETX 0x7E
+#define LSD_HEADER_LEN 3
+#define REUSE_HEADER_LEN 6
+
+#define NS_PER_SEC 1000000000ULL
+#define FRAME_NS 16683333ULL
+#define VBLANK_NS 2400000ULL
+#define VDP_STAT_VBLANK 0x0008
+
+// 8N1 framing: 10 bits on the line per byte
+#define UART_BYTE_NS (10 * NS_PER_SEC / UART_BR)
+#define UART_FIFO_LEN 16
+
+#define TO_CONSOLE_LEN 8192
+#define RTP_MIDI_PAYLOAD_TYPE 0x61
+
+#define VERSION_MAJOR 1
+#define VERSION_MINOR 5
+#define VERSION_MICRO 0
+#define VERSION_VARIANT "std"
+
+typedef enum FrameState {
+    FRAME_STX,
+    FRAME_CH_LENH,
+    FRAME_LEN,
+    FRAME_DATA,
+    FRAME_ETX
+} FrameState;
+
+typedef struct ConsoleFrame {
+    FrameState state;
+    u8 ch;
+    u16 length;
+    u16 pos;
+    char data[LSD_MAX_LEN];
+} ConsoleFrame;
+
+typedef struct Uart {
+    bool throttle;
+    uint64_t rxNextAt;
+    uint64_t txFreeAt;
+} Uart;
+
+typedef struct RtpTracker {
+    bool valid;
+    u32 ssrc;
+    u16 seqNum;
+} RtpTracker;
+
+volatile uint8_t uart_host_regs[16];
+
+static uint64_t start;
+static Uart uart;
+static StandinStats stats;
+static ConsoleFrame frame;
+static mw_cmd reply;
+static u8 toConsole[TO_CONSOLE_LEN];
+static u16 toConsoleHead;
+static u16 toConsoleCount;
+static int sockets[LSD_MAX_CH];
+static u8 nextPollCh;
+static RtpTracker rtp[LSD_MAX_CH];
+
+static uint64_t monotonicNanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+uint64_t standin_nanos(void)
+{
+    return monotonicNanos() - start;
+}
+
+u32 standin_frame(void)
+{
+    return standin_nanos() / FRAME_NS;
+}
+
+const StandinStats* standin_stats(void)
+{
+    return &stats;
+}
+
+void standin_init(bool throttleUart)
+{
+    start = monotonicNanos();
+    memset(&uart, 0, sizeof(uart));
+    memset(&stats, 0, sizeof(stats));
+    memset(&frame, 0, sizeof(frame));
+    memset(rtp, 0, sizeof(rtp));
+    uart.throttle = throttleUart;
+    toConsoleHead = 0;
+    toConsoleCount = 0;
+    nextPollCh = 1;
+    for (u8 ch = 0; ch < LSD_MAX_CH; ch++) {
+        sockets[ch] = -1;
+    }
+}
+
+uint16_t loop_host_vdp_status(void)
+{
+    uint64_t phase = standin_nanos() % FRAME_NS;
+    return phase >= FRAME_NS - VBLANK_NS ? VDP_STAT_VBLANK : 0;
+}
+
+static u16 toConsoleFree(void)
+{
+    return TO_CONSOLE_LEN - toConsoleCount;
+}
+
+static void pushToConsole(const void* data, u16 length)
+{
+    const u8* bytes = data;
+    for (u16 i = 0; i < length; i++) {
+        toConsole[(toConsoleHead + toConsoleCount) % TO_CONSOLE_LEN]
+            = bytes[i];
+        toConsoleCount++;
+    }
+    if (toConsoleCount > stats.maxBacklog) {
+        stats.maxBacklog = toConsoleCount;
+    }
+}
+
+static void pushFrameHeader(u8 ch, u16 length)
+{
+    u8 header[LSD_HEADER_LEN]
+        = { LSD_STX_ETX, (ch << 4) | (length >> 8), length & 0xFF };
+    pushToConsole(header, sizeof(header));
+}
+
+static void pushFrameEnd(void)
+{
+    u8 etx = LSD_STX_ETX;
+    pushToConsole(&etx, 1);
+}
+
+static void queueReply(u16 dataLength)
+{
+    u16 length = dataLength + 2 * sizeof(uint16_t);
+    reply.data_len = dataLength;
+    pushFrameHeader(MW_CTRL_CH, length);
+    pushToConsole(reply.packet, length);
+    pushFrameEnd();
+}
+
+static bool openUdp(const struct mw_msg_in_addr* addr)
+{
+    u8 ch = addr->channel;
+    if (ch == MW_CTRL_CH || ch >= LSD_MAX_CH) {
+        return false;
+    }
+    if (sockets[ch] >= 0) {
+        close(sockets[ch]);
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("standin: socket");
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in local = { .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(atoi(addr->src_port)) };
+    if (bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        perror("standin: bind");
+        close(fd);
+        return false;
+    }
+    sockets[ch] = fd;
+    rtp[ch].valid = false;
+    fprintf(stderr, "standin: ch %d bound to UDP %s\n", ch, addr->src_port);
+    return true;
+}
+
+static void handleCommand(const mw_cmd* cmd)
+{
+    memset(&reply, 0, sizeof(reply));
+    reply.cmd = MW_CMD_OK;
+    switch (cmd->cmd) {
+    case MW_CMD_VERSION:
+        reply.data[0] = VERSION_MAJOR;
+        reply.data[1] = VERSION_MINOR;
+        reply.data[2] = VERSION_MICRO;
+        strcpy((char*)reply.data + 3, VERSION_VARIANT);
+        queueReply(3 + sizeof(VERSION_VARIANT));
+        break;
+    case MW_CMD_AP_JOIN:
+        queueReply(0);
+        break;
+    case MW_CMD_SYS_STAT:
+        reply.sys_stat.sys_stat = MW_ST_READY;
+        reply.sys_stat.online = 1;
+        reply.sys_stat.cfg_ok = 1;
+        queueReply(sizeof(union mw_msg_sys_stat));
+        break;
+    case MW_CMD_IP_CURRENT:
+        reply.ip_cfg.ip.addr.addr = htonl(INADDR_LOOPBACK);
+        reply.ip_cfg.ip.mask.addr = htonl(IN_CLASSA_NET);
+        queueReply(sizeof(struct mw_msg_ip_cfg));
+        break;
+    case MW_CMD_UDP_SET:
+        if (!openUdp(&cmd->in_addr)) {
+            reply.cmd = MW_CMD_ERROR;
+        }
+        queueReply(0);
+        break;
+    case MW_CMD_SOCK_STAT:
+        reply.data[0] = cmd->data[0] < LSD_MAX_CH && sockets[cmd->data[0]] >= 0
+            ? MW_SOCK_UDP_READY
+            : MW_SOCK_NONE;
+        queueReply(1);
+        break;
+    default:
+        fprintf(stderr, "standin: unsupported command %d\n", cmd->cmd);
+        reply.cmd = MW_CMD_ERROR;
+        queueReply(0);
+        break;
+    }
+}
+
+static void sendDatagram(u8 ch, const char* data, u16 length)
+{
+    if (sockets[ch] < 0 || length < REUSE_HEADER_LEN) {
+        return;
+    }
+    const struct mw_reuse_payload* udp = (const struct mw_reuse_payload*)data;
+    struct sockaddr_in remote = { .sin_family = AF_INET,
+        .sin_addr.s_addr = udp->remote_ip,
+        .sin_port = htons(udp->remote_port) };
+    if (sendto(sockets[ch], udp->payload, length - REUSE_HEADER_LEN, 0,
+            (struct sockaddr*)&remote, sizeof(remote))
+        < 0) {
+        perror("standin: sendto");
+        return;
+    }
+    stats.udpOut++;
+}
+
+static void frameComplete(void)
+{
+    if (frame.ch == MW_CTRL_CH) {
+        handleCommand((const mw_cmd*)frame.data);
+    } else {
+        sendDatagram(frame.ch, frame.data, frame.length);
+    }
+}
+
+static void receiveFromConsole(u8 byte)
+{
+    stats.bytesFromConsole++;
+    switch (frame.state) {
+    case FRAME_STX:
+        // Anything outside a frame (e.g. line sync bytes) is ignored
+        if (byte == LSD_STX_ETX) {
+            frame.state = FRAME_CH_LENH;
+        }
+        break;
+    case FRAME_CH_LENH:
+        frame.ch = byte >> 4;
+        frame.length = (byte & 0x0F) << 8;
+        frame.state = FRAME_LEN;
+        break;
+    case FRAME_LEN:
+        frame.length |= byte;
+        frame.pos = 0;
+        frame.state = frame.length ? FRAME_DATA : FRAME_ETX;
+        break;
+    case FRAME_DATA:
+        frame.data[frame.pos++] = byte;
+        if (frame.pos == frame.length) {
+            frame.state = FRAME_ETX;
+        }
+        break;
+    case FRAME_ETX:
+        if (byte == LSD_STX_ETX) {
+            frameComplete();
+        } else {
+            fprintf(stderr, "standin: framing error on ch %d\n", frame.ch);
+        }
+        frame.state = FRAME_STX;
+        break;
+    }
+}
+
+static void trackRtpSequence(u8 ch, const u8* payload, ssize_t length)
+{
+    if (length < 12 || (payload[0] & 0xC0) != 0x80
+        || (payload[1] & 0x7F) != RTP_MIDI_PAYLOAD_TYPE) {
+        return;
+    }
+    u16 seqNum = payload[2] << 8 | payload[3];
+    u32 ssrc = (u32)payload[8] << 24 | payload[9] << 16 | payload[10] << 8
+        | payload[11];
+    RtpTracker* tracker = &rtp[ch];
+    stats.rtpIn++;
+    if (tracker->valid && tracker->ssrc == ssrc) {
+        u16 gap = seqNum - tracker->seqNum - 1;
+        if (gap < 0x8000) {
+            stats.rtpLost += gap;
+        }
+    }
+    tracker->valid = true;
+    tracker->ssrc = ssrc;
+    tracker->seqNum = seqNum;
+}
+
+static bool receiveDatagram(u8 ch)
+{
+    static struct mw_reuse_payload udp;
+    struct sockaddr_in remote;
+    socklen_t remoteLen = sizeof(remote);
+    ssize_t length = recvfrom(sockets[ch], udp.payload, sizeof(udp.payload),
+        MSG_DONTWAIT, (struct sockaddr*)&remote, &remoteLen);
+    if (length < 0) {
+        return false;
+    }
+    stats.udpIn++;
+    trackRtpSequence(ch, (const u8*)udp.payload, length);
+    udp.remote_ip = remote.sin_addr.s_addr;
+    udp.remote_port = ntohs(remote.sin_port);
+    u16 frameLength = length + REUSE_HEADER_LEN;
+    pushFrameHeader(ch, frameLength);
+    pushToConsole(&udp, frameLength);
+    pushFrameEnd();
+    return true;
+}
+
+// The module only forwards a datagram once it has room to buffer the
+// whole frame, so a console that falls behind shows up as datagrams
+// dropped by the host socket and hence as RTP sequence gaps.
+static void pollSockets(void)
+{
+    for (u8 i = 1; i < LSD_MAX_CH; i++) {
+        if (toConsoleFree() < LSD_MAX_LEN + LSD_HEADER_LEN + 1) {
+            return;
+        }
+        u8 ch = nextPollCh;
+        nextPollCh = nextPollCh + 1 < LSD_MAX_CH ? nextPollCh + 1 : 1;
+        if (sockets[ch] >= 0 && receiveDatagram(ch)) {
+            return;
+        }
+    }
+}
+
+static uint64_t max64(uint64_t a, uint64_t b)
+{
+    return a > b ? a : b;
+}
+
+int uart_host_rx_ready(void)
+{
+    if (toConsoleCount == 0) {
+        pollSockets();
+        if (toConsoleCount == 0) {
+            return 0;
+        }
+    }
+    return !uart.throttle || standin_nanos() >= uart.rxNextAt;
+}
+
+uint8_t uart_host_getc(void)
+{
+    if (toConsoleCount == 0) {
+        return 0;
+    }
+    if (uart.throttle) {
+        // Bytes arrive at the line rate, but up to a FIFO's worth may
+        // have built up while the console was busy elsewhere
+        uint64_t now = standin_nanos();
+        uint64_t fifoStart = now > UART_FIFO_LEN * UART_BYTE_NS
+            ? now - UART_FIFO_LEN * UART_BYTE_NS
+            : 0;
+        uart.rxNextAt = max64(uart.rxNextAt, fifoStart) + UART_BYTE_NS;
+    }
+    u8 byte = toConsole[toConsoleHead];
+    toConsoleHead = (toConsoleHead + 1) % TO_CONSOLE_LEN;
+    toConsoleCount--;
+    stats.bytesToConsole++;
+    return byte;
+}
+
+int uart_host_tx_ready(void)
+{
+    return !uart.throttle || standin_nanos() >= uart.txFreeAt;
+}
+
+void uart_host_putc(uint8_t c)
+{
+    if (uart.throttle) {
+        uart.txFreeAt = max64(uart.txFreeAt, standin_nanos()) + UART_BYTE_NS;
+    }
+    receiveFromConsole(c);
+}
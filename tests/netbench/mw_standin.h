@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <types.h>
+
+// Stand-in for the MegaWiFi module on a Linux host. The firmware's LSD
+// driver talks to it through the pseudo-UART hooks in 16c550.h, and it
+// bridges the UDP channels to real sockets on the host.
+
+typedef struct StandinStats StandinStats;
+
+struct StandinStats {
+    u32 udpIn;
+    u32 udpOut;
+    u32 rtpIn;
+    u32 rtpLost;
+    u32 bytesToConsole;
+    u32 bytesFromConsole;
+    u16 maxBacklog;
+};
+
+void standin_init(bool throttleUart);
+uint64_t standin_nanos(void);
+u32 standin_frame(void);
+const StandinStats* standin_stats(void);
@@ -259,6 +259,7 @@ static void test_pong_received_after_ping_sent()
     }
 
     midi_receiver_read();
+    comm_flush();
 }
 
 static void test_loads_psg_envelope()
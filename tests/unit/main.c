@@ -3,7 +3,9 @@
 #include "test_comm.c"
 #include "test_comm_megawifi.c"
 #include "test_log.c"
+#include "test_mpool.c"
 #include "test_midi.h"
+#include "test_midi_bundle.c"
 #include "test_midi_dynamic.c"
 #include "test_midi_fm.c"
 #include "test_midi_polyphony.c"
@@ -26,6 +28,8 @@
 #define scheduler_test(test) cmocka_unit_test_setup(test, test_scheduler_setup)
 #define applemidi_test(test) cmocka_unit_test_setup(test, test_applemidi_setup)
 #define buffer_test(test) cmocka_unit_test_setup(test, test_buffer_setup)
+#define midi_bundle_test(test)                                                 \
+    cmocka_unit_test_setup(test, test_midi_bundle_setup)
 
 int main(void)
 {
@@ -50,6 +54,22 @@ int main(void)
         cmocka_unit_test(test_midi_receiver_sends_sysex_to_midi_layer),
         cmocka_unit_test(test_midi_receiver_handles_sysex_limits),
         cmocka_unit_test(test_midi_receiver_sends_midi_reset),
+        cmocka_unit_test(test_midi_receiver_handles_running_status),
+        cmocka_unit_test(
+            test_midi_receiver_keeps_running_status_across_realtime_messages),
+        cmocka_unit_test(
+            test_midi_receiver_keeps_running_status_across_queued_sysex),
+        cmocka_unit_test(
+            test_midi_receiver_clears_running_status_after_inline_sysex),
+        cmocka_unit_test(
+            test_midi_receiver_reads_messages_while_sysex_suspended),
+        cmocka_unit_test(test_midi_receiver_ignores_data_beyond_sysex_limit),
+        cmocka_unit_test(
+            test_midi_receiver_ends_unterminated_sysex_at_next_status),
+        cmocka_unit_test(
+            test_midi_receiver_handles_compact_note_on_with_implicit_velocity),
+        cmocka_unit_test(test_midi_receiver_handles_compact_note_off),
+        cmocka_unit_test(test_midi_receiver_handles_compact_cc_delta_stream),
 
         midi_test(test_midi_triggers_synth_note_on),
         midi_test(test_midi_triggers_synth_note_on_with_velocity),
@@ -143,6 +163,17 @@ int main(void)
         midi_test(test_midi_sysex_enables_dynamic_channel_mode),
         midi_test(test_midi_sysex_disables_fm_parameter_CCs),
         midi_test(test_midi_sysex_loads_psg_envelope),
+        midi_test(test_midi_sysex_sets_network_jitter_buffer_cap),
+        midi_test(test_midi_sysex_queues_timestamped_bundle),
+        midi_test(test_midi_sysex_replies_to_ping),
+        midi_test(test_midi_sysex_drops_pong_if_tx_buffer_full),
+
+        midi_bundle_test(test_midi_bundle_plays_events_at_target_time),
+        midi_bundle_test(
+            test_midi_bundle_keeps_timeline_when_delivery_is_delayed),
+        midi_bundle_test(test_midi_bundle_orders_events_by_target_time),
+        midi_bundle_test(test_midi_bundle_plays_channel_voice_messages),
+        midi_bundle_test(test_midi_bundle_ignores_events_after_invalid_status),
         midi_test(
             test_midi_sets_all_channel_mappings_when_setting_polyphonic_mode),
         midi_test(test_midi_shows_fm_parameter_ui),
@@ -191,15 +222,36 @@ int main(void)
 
         comm_test(test_comm_reads_from_serial_when_ready),
         comm_test(test_comm_reads_when_ready),
+        comm_test(test_comm_reports_sysex_queued_by_serial),
+        comm_test(test_comm_reports_sysex_inline_for_everdrive),
         comm_test(test_comm_writes_when_ready),
+        comm_test(test_comm_reports_space_left_to_write),
+        comm_test(test_comm_warns_once_when_dropping_writes),
+        comm_test(test_comm_queues_writes_until_comm_type_is_known),
+        comm_test(test_comm_flushes_writes_of_active_transport),
         comm_test(test_comm_idle_count_is_correct),
         comm_test(test_comm_busy_count_is_correct),
         comm_test(test_comm_clamps_idle_count),
         comm_test(test_comm_clamps_busy_count),
 
         comm_megawifi_test(test_comm_megawifi_initialises),
+        comm_megawifi_test(test_comm_megawifi_polls_status_until_associated),
+        comm_megawifi_test(
+            test_comm_megawifi_stops_if_udp_port_cannot_be_opened),
+        comm_megawifi_test(
+            test_comm_megawifi_ignores_datagram_while_awaiting_reply),
+        comm_megawifi_test(
+            test_comm_megawifi_gives_up_when_module_does_not_reply),
+        comm_megawifi_test(test_comm_megawifi_does_not_start_without_uart),
         comm_megawifi_test(test_comm_megawifi_reads_midi_message),
         comm_megawifi_test(test_comm_megawifi_logs_if_buffer_full),
+        comm_megawifi_test(
+            test_comm_megawifi_queues_sends_while_send_in_flight),
+        comm_megawifi_test(test_comm_megawifi_builds_packets_in_place),
+        comm_megawifi_test(
+            test_comm_megawifi_returns_no_send_buffer_when_queue_full),
+        comm_megawifi_test(test_comm_megawifi_receives_while_send_in_flight),
+        comm_megawifi_test(test_comm_megawifi_reads_raw_ipmidi_datagram),
 
         dynamic_midi_test(test_midi_dynamic_uses_all_channels),
         dynamic_midi_test(
@@ -246,6 +298,8 @@ int main(void)
         scheduler_test(test_scheduler_nothing_called_on_vsync),
         scheduler_test(test_scheduler_processes_frame_events_once_after_vsync),
         scheduler_test(test_scheduler_tick_runs_midi_receiver),
+        scheduler_test(test_scheduler_timestamp_interpolates_within_frame),
+        scheduler_test(test_scheduler_runs_tasks_on_tick_until_ended),
 
         applemidi_test(
             test_applemidi_parses_rtpmidi_packet_with_single_midi_event),
@@ -263,17 +317,70 @@ int main(void)
             test_applemidi_parses_rtpmidi_packet_with_multiple_2_byte_midi_events),
         applemidi_test(test_applemidi_parses_rtpmidi_packet_with_sysex),
         applemidi_test(test_applemidi_parses_notes_sysex_cc_in_one_packet),
-        applemidi_test(test_applemidi_ignores_middle_sysex_segments),
+        applemidi_test(
+            test_applemidi_plays_notes_around_sysex_segments_without_start),
         applemidi_test(test_applemidi_processes_multiple_sysex_segments),
         applemidi_test(test_applemidi_processes_ccs),
         applemidi_test(test_applemidi_sets_last_sequence_number),
         applemidi_test(test_applemidi_sends_receiver_feedback),
-        applemidi_test(
-            test_applemidi_parses_rtpmidi_packet_with_sysex_ending_with_F0),
         applemidi_test(
             test_applemidi_parses_rtpmidi_packet_with_sysex_with_0xF7_at_end),
         applemidi_test(test_applemidi_does_not_read_beyond_length),
         applemidi_test(test_applemidi_parses_rtpmidi_packet_with_system_reset),
+        applemidi_test(
+            test_applemidi_recovers_note_off_from_journal_after_packet_loss),
+        applemidi_test(
+            test_applemidi_recovers_ccs_and_pitch_bend_from_journal),
+        applemidi_test(test_applemidi_ignores_journal_when_no_packets_lost),
+        applemidi_test(test_applemidi_recovers_after_sequence_number_zero),
+        applemidi_test(test_applemidi_recovers_across_sequence_number_wrap),
+        applemidi_test(test_applemidi_ignores_duplicate_packets),
+        applemidi_test(test_applemidi_ignores_late_packets),
+        applemidi_test(test_applemidi_restarts_sequence_on_reinvite),
+        applemidi_test(
+            test_applemidi_does_not_track_sequence_without_session),
+        applemidi_test(test_applemidi_tracks_concurrent_sessions),
+        applemidi_test(
+            test_applemidi_rejects_invitation_when_session_limit_reached),
+        applemidi_test(test_applemidi_ends_session),
+        applemidi_test(test_applemidi_reuses_slot_of_timed_out_session),
+        applemidi_test(test_applemidi_parses_rtpmidi_packet_with_12_bit_length),
+        applemidi_test(
+            test_applemidi_parses_rtpmidi_packet_with_multi_byte_deltas),
+        applemidi_test(
+            test_applemidi_schedules_events_at_delta_time_offsets),
+        applemidi_test(test_applemidi_emits_pending_events_before_sysex),
+        applemidi_test(test_applemidi_plays_late_packets_on_arrival),
+        applemidi_test(
+            test_applemidi_holds_early_packets_until_mean_transit_time),
+        applemidi_test(
+            test_applemidi_plays_events_of_sessions_in_due_order),
+        applemidi_test(test_applemidi_adds_jitter_margin_up_to_cap),
+        applemidi_test(test_applemidi_responds_to_timestamp_sync),
+        applemidi_test(test_applemidi_estimates_clock_offset_and_latency),
+        applemidi_test(test_applemidi_starts_playout_from_clock_estimates),
+        applemidi_test(test_applemidi_sends_midi_written_in_tick_as_one_packet),
+        applemidi_test(test_applemidi_increments_sent_sequence_number),
+        applemidi_test(test_applemidi_sends_midi_to_all_sessions),
+        applemidi_test(test_applemidi_splits_long_sysex_across_packets),
+        applemidi_test(
+            test_applemidi_keeps_later_events_of_other_sessions_at_sysex),
+        applemidi_test(
+            test_applemidi_reassembles_sysex_segments_across_packets),
+        applemidi_test(
+            test_applemidi_reassembles_sysex_of_each_session_separately),
+        applemidi_test(test_applemidi_drops_sysex_after_lost_segment),
+        applemidi_test(test_applemidi_drops_cancelled_sysex),
+        applemidi_test(test_applemidi_drops_sysex_longer_than_buffer),
+        applemidi_test(test_applemidi_sends_receiver_feedback_once_idle),
+        applemidi_test(test_applemidi_holds_receiver_feedback_while_busy),
+        applemidi_test(
+            test_applemidi_sends_receiver_feedback_after_many_packets),
+        applemidi_test(
+            test_applemidi_sends_receiver_feedback_early_for_large_journal),
+        applemidi_test(test_applemidi_stops_parsing_at_invalid_delta),
+        applemidi_test(test_applemidi_rejects_truncated_rtpmidi_packet),
+        applemidi_test(test_applemidi_ignores_sysex_without_terminator),
 
         cmocka_unit_test(test_vstring_handles_variable_argument_list_correctly),
 
@@ -283,7 +390,17 @@ int main(void)
         buffer_test(test_buffer_available_returns_correct_value_when_empty),
         buffer_test(test_buffer_available_returns_correct_value_when_full),
         buffer_test(test_buffer_returns_cannot_write_if_full),
-        buffer_test(test_buffer_returns_can_write_if_empty)
+        buffer_test(test_buffer_returns_can_write_if_empty),
+        buffer_test(test_buffer_reads_notes_before_earlier_sysex),
+        buffer_test(test_buffer_does_not_read_incomplete_sysex),
+        buffer_test(test_buffer_reads_sysex_only_between_messages),
+        buffer_test(test_buffer_reads_realtime_within_sysex_first),
+        buffer_test(test_buffer_drops_sysex_larger_than_queue),
+        buffer_test(test_buffer_reads_sysex_between_notes_of_busy_queue),
+        buffer_test(test_buffer_suspends_long_sysex_for_notes),
+        cmocka_unit_test(test_mpool_block_pool_allocates_until_exhausted),
+        cmocka_unit_test(test_mpool_block_pool_reuses_freed_blocks),
+        cmocka_unit_test(test_mpool_block_pool_fails_if_blocks_cannot_hold_link)
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -1,11 +1,83 @@
 #include "cmocka_inc.h"
 #include "applemidi.h"
+#include "rtpmidi.h"
+#include "comm_megawifi.h"
+#include <memory.h>
+
+#define REMOTE_IP 0xC0A80102
+#define REMOTE_IP_2 0xC0A80103
+#define REMOTE_CONTROL_PORT 5004
+#define REMOTE_MIDI_PORT 5005
 
 static int test_applemidi_setup(UNUSED void** state)
 {
+    wraps_scheduler_setTimestamp(0);
+    applemidi_init();
     return 0;
 }
 
+static mw_err processMidiPacket(char* packet, u16 length)
+{
+    return applemidi_processSessionMidiPacket(
+        REMOTE_IP, REMOTE_MIDI_PORT, packet, length);
+}
+
+static void advanceTime(u32 units)
+{
+    wraps_scheduler_setTimestamp(__wrap_scheduler_timestamp() + units);
+    rtpmidi_tick();
+}
+
+static void expect_invitation_response(
+    u8 ch, u32 ip, u16 port, const char* command)
+{
+    const u8 responseHeader[] = { 0xFF, 0xFF, command[0], command[1] };
+
+    expect_value(__wrap_comm_megawifi_queueSend, ch, ch);
+    expect_value(__wrap_comm_megawifi_queueSend, remoteIp, ip);
+    expect_value(__wrap_comm_megawifi_queueSend, remotePort, port);
+    expect_memory(__wrap_comm_megawifi_queueSend, payload, responseHeader,
+        sizeof(responseHeader));
+    expect_value(__wrap_comm_megawifi_queueSend, len, EXCHANGE_PACKET_LEN);
+}
+
+static void invite(u8 ch, u32 ip, u16 port, u32 ssrc)
+{
+    char invitation[EXCHANGE_PACKET_LEN] = { 0xFF, 0xFF, 'I', 'N',
+        /* version */ 0x00, 0x00, 0x00, 0x02, /* init token */ 0x11, 0x22,
+        0x33, 0x44, /* SSRC */ (u8)(ssrc >> 24), (u8)(ssrc >> 16),
+        (u8)(ssrc >> 8), (u8)ssrc, 'H', 'o', 's', 't' };
+    mw_err err = ch == CH_CONTROL_PORT
+        ? applemidi_processSessionControlPacket(
+            ip, port, invitation, sizeof(invitation))
+        : applemidi_processSessionMidiPacket(
+            ip, port, invitation, sizeof(invitation));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void start_session(u32 ip, u32 ssrc)
+{
+    expect_invitation_response(CH_CONTROL_PORT, ip, REMOTE_CONTROL_PORT, "OK");
+    invite(CH_CONTROL_PORT, ip, REMOTE_CONTROL_PORT, ssrc);
+    expect_invitation_response(CH_MIDI_PORT, ip, REMOTE_MIDI_PORT, "OK");
+    invite(CH_MIDI_PORT, ip, REMOTE_MIDI_PORT, ssrc);
+}
+
+static void expect_receiver_feedback(u32 ip, u16 seqNum)
+{
+    const u8 receiverFeedbackPacket[] = { 0xff, 0xff, 'R', 'S',
+        /* SSRC */ 0x9E, 0x91, 0x51, 0x50, /* sequence number */
+        (u8)(seqNum >> 8), (u8)seqNum, 0x00, 0x00 };
+    expect_value(__wrap_comm_megawifi_queueSend, ch, CH_CONTROL_PORT);
+    expect_value(__wrap_comm_megawifi_queueSend, remoteIp, ip);
+    expect_value(
+        __wrap_comm_megawifi_queueSend, remotePort, REMOTE_CONTROL_PORT);
+    expect_memory(__wrap_comm_megawifi_queueSend, payload,
+        receiverFeedbackPacket, sizeof(receiverFeedbackPacket));
+    expect_value(
+        __wrap_comm_megawifi_queueSend, len, sizeof(receiverFeedbackPacket));
+}
+
 static void test_applemidi_parses_rtpmidi_packet_with_single_midi_event(
     UNUSED void** state)
 {
@@ -20,7 +92,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_single_midi_event(
     expect_midi_emit(0x48);
     expect_midi_emit(0x6f);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -32,7 +104,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_single_2_byte_midi_event(
     for (u16 i = 0; i < sizeof(statuses); i++) {
         u8 status = statuses[i];
         char rtp_packet[1024] = { /* V P X CC M PT */ 0x80, 0x61,
-            /* sequence number */ 0x8c, 0x24,
+            /* sequence number */ 0x8c, (u8)(0x24 + i),
             /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
             0x08, /* MIDI command section */ 0x02, status, 0x01 };
         size_t len = sizeof(rtp_packet);
@@ -40,7 +112,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_single_2_byte_midi_event(
         expect_midi_emit(status);
         expect_midi_emit(0x01);
 
-        mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+        mw_err err = processMidiPacket(rtp_packet, len);
         assert_int_equal(err, MW_ERR_NONE);
     }
 }
@@ -54,7 +126,7 @@ test_applemidi_parses_rtpmidi_packet_with_multiple_2_byte_midi_events(
     for (u16 i = 0; i < sizeof(statuses); i++) {
         u8 status = statuses[i];
         char rtp_packet[1024] = { /* V P X CC M PT */ 0x80, 0x61,
-            /* sequence number */ 0x8c, 0x24,
+            /* sequence number */ 0x8c, (u8)(0x24 + i),
             /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
             0x08, /* MIDI command section */ 0x05, status, 0x01, 0x00, status,
             0x01 };
@@ -65,7 +137,7 @@ test_applemidi_parses_rtpmidi_packet_with_multiple_2_byte_midi_events(
         expect_midi_emit(status);
         expect_midi_emit(0x01);
 
-        mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+        mw_err err = processMidiPacket(rtp_packet, len);
         assert_int_equal(err, MW_ERR_NONE);
     }
 }
@@ -85,7 +157,7 @@ test_applemidi_parses_rtpmidi_packet_with_single_midi_event_long_header(
     expect_midi_emit(0x48);
     expect_midi_emit(0x6f);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -108,7 +180,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_two_midi_events(
     expect_midi_emit(0x51);
     expect_midi_emit(0x7c);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -135,7 +207,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_multiple_midi_events(
     expect_midi_emit(0x48);
     expect_midi_emit(0x6f);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -154,27 +226,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_sysex(UNUSED void** state)
     expect_midi_emit(0x56);
     expect_midi_emit(0xF7);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtpPacket, len);
-    assert_int_equal(err, MW_ERR_NONE);
-}
-
-static void test_applemidi_parses_rtpmidi_packet_with_sysex_ending_with_F0(
-    UNUSED void** state)
-{
-    char rtpPacket[1024] = { /* V P X CC M PT */ 0x80, 0x61,
-        /* sequence number */ 0x8c, 0x24,
-        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
-        0x08, /* MIDI command section */ 0x05, 0xF0, 0x12, 0x34, 0x56, 0xF0 };
-
-    size_t len = sizeof(rtpPacket);
-
-    expect_midi_emit(0xF0);
-    expect_midi_emit(0x12);
-    expect_midi_emit(0x34);
-    expect_midi_emit(0x56);
-    expect_midi_emit(0xF7);
-
-    mw_err err = applemidi_processSessionMidiPacket(rtpPacket, len);
+    mw_err err = processMidiPacket(rtpPacket, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -195,7 +247,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_sysex_with_0xF7_at_end(
     expect_midi_emit(0x56);
     expect_midi_emit(0xF7);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtpPacket, len);
+    mw_err err = processMidiPacket(rtpPacket, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -223,7 +275,7 @@ test_applemidi_parses_rtpmidi_packet_with_multiple_different_midi_events(
     expect_midi_emit(0x48);
     expect_midi_emit(0x6f);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -238,7 +290,7 @@ static void test_applemidi_parses_rtpmidi_packet_with_system_reset(
     size_t len = sizeof(rtp_packet);
     expect_midi_emit(0xff);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -287,11 +339,13 @@ static void test_applemidi_parses_notes_sysex_cc_in_one_packet(
     expect_midi_emit_trio(0xb7, 0x00, 0x00);
     expect_midi_emit_trio(0xe9, 0x00, 0x00);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
+    advanceTime(100);
 }
 
-static void test_applemidi_ignores_middle_sysex_segments(UNUSED void** state)
+static void test_applemidi_plays_notes_around_sysex_segments_without_start(
+    UNUSED void** state)
 {
     const u8 endings[] = { 0xF0, 0xF7 };
     const u8 cmd_length = 11;
@@ -301,7 +355,8 @@ static void test_applemidi_ignores_middle_sysex_segments(UNUSED void** state)
         print_message("Testing segment %d\n", i);
 
         char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
-            /* sequence number */ 0xe0, 0x19, /* timestamp */ 0x03, 0x31, 0xdd,
+            /* sequence number */ 0xe0, 0x19 + i, /* timestamp */ 0x03, 0x31,
+            0xdd,
             0x6d, /* SSRC */ 0x09, 0x0f, 0x92, 0xe9,
             /* MIDI command section */ 0xc0, cmd_length, /* cmds */ 0x90, 0x60,
             0x61, 0x00, /* | */ 0xF7, 0x00, ending, 0x01,
@@ -312,8 +367,9 @@ static void test_applemidi_ignores_middle_sysex_segments(UNUSED void** state)
         expect_midi_emit_trio(0x90, 0x60, 0x61);
         expect_midi_emit_trio(0x90, 0x60, 0x61);
 
-        mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+        mw_err err = processMidiPacket(rtp_packet, len);
         assert_int_equal(err, MW_ERR_NONE);
+        advanceTime(100);
     }
 }
 
@@ -334,7 +390,7 @@ static void test_applemidi_processes_multiple_sysex_segments(
     expect_midi_emit_trio(0xF0, 0x01, 0xF7);
     expect_midi_emit_trio(0xF0, 0x02, 0xF7);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -370,8 +426,9 @@ static void test_applemidi_processes_ccs(UNUSED void** state)
     expect_midi_emit_trio(0xb1, 0x64, 0x00);
     expect_midi_emit_trio(0xb1, 0x65, 0x00);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
+    advanceTime(100);
 }
 
 static void test_applemidi_sets_last_sequence_number(UNUSED void** state)
@@ -387,7 +444,7 @@ static void test_applemidi_sets_last_sequence_number(UNUSED void** state)
     expect_midi_emit(0x48);
     expect_midi_emit(0x6f);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 
     u16 seqNum = applemidi_lastSequenceNumber();
@@ -396,6 +453,8 @@ static void test_applemidi_sets_last_sequence_number(UNUSED void** state)
 
 static void test_applemidi_sends_receiver_feedback(UNUSED void** state)
 {
+    start_session(REMOTE_IP, 0xac67e108);
+
     char rtp_packet[1024] = { /* V P X CC M PT */ 0x80, 0x61,
         /* sequence number */ 0x00, 0x01,
         /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
@@ -407,19 +466,12 @@ static void test_applemidi_sends_receiver_feedback(UNUSED void** state)
     expect_midi_emit(0x48);
     expect_midi_emit(0x6f);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 
-    const u8 receiverFeedbackPacket[] = { 0xff, 0xff, 'R', 'S',
-        /* SSRC */ 0x9E, 0x91, 0x51, 0x50, /* sequence number */
-        0x00, 0x01, 0x00, 0x00 };
-    expect_value(__wrap_comm_megawifi_send, ch, CH_CONTROL_PORT);
-    expect_memory(__wrap_comm_megawifi_send, data, receiverFeedbackPacket,
-        sizeof(receiverFeedbackPacket));
-    expect_value(
-        __wrap_comm_megawifi_send, len, sizeof(receiverFeedbackPacket));
+    expect_receiver_feedback(REMOTE_IP, 0x0001);
 
-    err = applemidi_sendReceiverFeedback();
+    err = applemidi_sendReceiverFeedback(RECEIVER_FEEDBACK_MIN_FRAMES, true);
     assert_int_equal(err, MW_ERR_NONE);
 }
 
@@ -436,9 +488,836 @@ static void test_applemidi_does_not_read_beyond_length(UNUSED void** state)
 
     expect_midi_emit_trio(0xF0, 0x01, 0xF7);
 
-    mw_err err = applemidi_processSessionMidiPacket(rtp_packet, len);
+    mw_err err = processMidiPacket(rtp_packet, len);
     assert_int_equal(err, MW_ERR_NONE);
 
     u16 seqNum = applemidi_lastSequenceNumber();
     assert_int_equal(seqNum, 0x8c24);
 }
+
+static void test_applemidi_recovers_note_off_from_journal_after_packet_loss(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    char notePacket[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x10,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x03, 0x90, 0x48, 0x6f };
+
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    mw_err err = processMidiPacket(notePacket, sizeof(notePacket));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    char journalPacket[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x12,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x50, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x40,
+        /* journal header */ 0x20, 0x00, 0x10,
+        /* channel journal (chan 0, N) */ 0x00, 0x06, 0x08,
+        /* chapter N */ 0x00, 0x99, /* off bits */ 0x80 };
+
+    expect_midi_emit_trio(0x80, 0x48, 0x00);
+    err = processMidiPacket(journalPacket, sizeof(journalPacket));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_recovers_ccs_and_pitch_bend_from_journal(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    char packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x20,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x00 };
+
+    mw_err err = processMidiPacket(packet, sizeof(packet));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    char journalPacket[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x22,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x50, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x40,
+        /* journal header */ 0x20, 0x00, 0x20,
+        /* channel journal (chan 1, C & W) */ 0x08, 0x08, 0x50,
+        /* chapter C */ 0x00, 0x07, 0x64, /* chapter W */ 0x00, 0x40 };
+
+    expect_midi_emit_trio(0xB1, 0x07, 0x64);
+    expect_midi_emit_trio(0xE1, 0x00, 0x40);
+    err = processMidiPacket(journalPacket, sizeof(journalPacket));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_ignores_journal_when_no_packets_lost(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    char packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x30,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x00 };
+
+    mw_err err = processMidiPacket(packet, sizeof(packet));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    char journalPacket[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x31,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x50, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x40,
+        /* journal header */ 0x20, 0x00, 0x30,
+        /* channel journal (chan 1, C) */ 0x08, 0x06, 0x40,
+        /* chapter C */ 0x00, 0x07, 0x64 };
+
+    err = processMidiPacket(journalPacket, sizeof(journalPacket));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_tracks_concurrent_sessions(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    start_session(REMOTE_IP_2, 0x12345678);
+    assert_int_equal(applemidi_sessionCount(), 2);
+
+    char packet1[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x05,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x03, 0x90, 0x48, 0x6f };
+    char packet2[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x01, 0x00,
+        /* timestamp */ 0x00, 0x00, 0x01, 0x40, /* SSRC */ 0x12, 0x34, 0x56,
+        0x78, /* MIDI command section */ 0x03, 0x91, 0x40, 0x7f };
+
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    mw_err err = processMidiPacket(packet1, sizeof(packet1));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    expect_midi_emit_trio(0x91, 0x40, 0x7f);
+    err = applemidi_processSessionMidiPacket(
+        REMOTE_IP_2, REMOTE_MIDI_PORT, packet2, sizeof(packet2));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    expect_receiver_feedback(REMOTE_IP, 0x0005);
+    expect_receiver_feedback(REMOTE_IP_2, 0x0100);
+    err = applemidi_sendReceiverFeedback(RECEIVER_FEEDBACK_MIN_FRAMES, true);
+    assert_int_equal(err, MW_ERR_NONE);
+
+    err = applemidi_sendReceiverFeedback(RECEIVER_FEEDBACK_MIN_FRAMES, true);
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_rejects_invitation_when_session_limit_reached(
+    UNUSED void** state)
+{
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        start_session(REMOTE_IP + i, 0x1000 + i);
+    }
+
+    expect_invitation_response(
+        CH_CONTROL_PORT, REMOTE_IP_2, REMOTE_CONTROL_PORT, "NO");
+    invite(CH_CONTROL_PORT, REMOTE_IP_2, REMOTE_CONTROL_PORT, 0x2000);
+
+    assert_int_equal(applemidi_sessionCount(), APPLE_MIDI_MAX_SESSIONS);
+}
+
+static void test_applemidi_ends_session(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    char endSession[APPLE_MIDI_END_SESSION_PKT_LEN] = { 0xFF, 0xFF, 'B', 'Y',
+        /* version */ 0x00, 0x00, 0x00, 0x02, /* init token */ 0x11, 0x22,
+        0x33, 0x44, /* SSRC */ 0xac, 0x67, 0xe1, 0x08 };
+    mw_err err = applemidi_processSessionControlPacket(
+        REMOTE_IP, REMOTE_CONTROL_PORT, endSession, sizeof(endSession));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    assert_int_equal(applemidi_sessionCount(), 0);
+}
+
+static void inviteControl(u32 ip, u32 ssrc, const char* response)
+{
+    expect_invitation_response(
+        CH_CONTROL_PORT, ip, REMOTE_CONTROL_PORT, response);
+    invite(CH_CONTROL_PORT, ip, REMOTE_CONTROL_PORT, ssrc);
+}
+
+static void test_applemidi_reuses_slot_of_timed_out_session(
+    UNUSED void** state)
+{
+    for (u8 i = 0; i < APPLE_MIDI_MAX_SESSIONS; i++) {
+        start_session(REMOTE_IP, 0x1000 + i);
+        advanceTime(1000);
+    }
+    inviteControl(REMOTE_IP, 0x1000, "OK");
+
+    advanceTime(APPLE_MIDI_SESSION_TIMEOUT - 2999);
+    inviteControl(REMOTE_IP_2, 0x2000, "OK");
+    inviteControl(REMOTE_IP_2, 0x2001, "NO");
+    inviteControl(REMOTE_IP, 0x1001, "NO");
+    inviteControl(REMOTE_IP, 0x1000, "OK");
+
+    assert_int_equal(applemidi_sessionCount(), APPLE_MIDI_MAX_SESSIONS);
+}
+
+static void test_applemidi_parses_rtpmidi_packet_with_12_bit_length(
+    UNUSED void** state)
+{
+    const u16 midiLength = 0x102;
+    char rtp_packet[RTP_MIDI_HEADER_LEN + 2 + 0x102] = { /* V P X CC M PT */
+        0x80, 0x61, /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x81, 0x02, 0x90, 0x3c, 0x40 };
+    for (u16 i = RTP_MIDI_HEADER_LEN + 5; i < sizeof(rtp_packet); i += 3) {
+        rtp_packet[i] = 0x00; /* delta */
+        rtp_packet[i + 1] = 0x3c;
+        rtp_packet[i + 2] = 0x40;
+    }
+
+    for (u16 i = 0; i < midiLength / 3; i++) {
+        expect_midi_emit_trio(0x90, 0x3c, 0x40);
+    }
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_parses_rtpmidi_packet_with_multi_byte_deltas(
+    UNUSED void** state)
+{
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section (Z flag set) */ 0x2C,
+        /* delta */ 0x80, 0x80, 0x81, 0x00, /* cmd */ 0x90, 0x48, 0x6f,
+        /* delta */ 0x82, 0x01, /* cmd */ 0x80, 0x48, 0x00 };
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    wraps_scheduler_setTimestamp(128);
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    rtpmidi_tick();
+
+    wraps_scheduler_setTimestamp(385);
+    expect_midi_emit_trio(0x80, 0x48, 0x00);
+    rtpmidi_tick();
+}
+
+static void test_applemidi_schedules_events_at_delta_time_offsets(
+    UNUSED void** state)
+{
+    wraps_scheduler_setTimestamp(1000);
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x09, 0x90, 0x48, 0x6f,
+        /* delta */ 0x32, /* cmd */ 0x80, 0x48, 0x00,
+        /* delta */ 0x14, /* cmd */ 0xF8 };
+
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+
+    wraps_scheduler_setTimestamp(1049);
+    rtpmidi_tick();
+
+    wraps_scheduler_setTimestamp(1050);
+    expect_midi_emit_trio(0x80, 0x48, 0x00);
+    rtpmidi_tick();
+
+    wraps_scheduler_setTimestamp(1100);
+    expect_midi_emit(0xF8);
+    rtpmidi_tick();
+}
+
+static void test_applemidi_emits_pending_events_before_sysex(
+    UNUSED void** state)
+{
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x0B, 0x90, 0x48, 0x6f,
+        /* delta */ 0x32, /* cmd */ 0x80, 0x48, 0x00,
+        /* delta */ 0x00, /* cmd */ 0xF0, 0x01, 0xF7 };
+
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    expect_midi_emit_trio(0x80, 0x48, 0x00);
+    expect_midi_emit_trio(0xF0, 0x01, 0xF7);
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void processSessionNoteAt(
+    u32 ssrc, u16 seqNum, u32 timestamp, u8 pitch)
+{
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ seqNum >> 8, seqNum,
+        /* timestamp */ timestamp >> 24, timestamp >> 16, timestamp >> 8,
+        timestamp, /* SSRC */ ssrc >> 24, ssrc >> 16, ssrc >> 8, ssrc,
+        /* MIDI command section */ 0x03, 0x90, pitch, 0x7f };
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void processNoteAt(u16 seqNum, u32 timestamp, u8 pitch)
+{
+    processSessionNoteAt(0xac67e108, seqNum, timestamp, pitch);
+}
+
+static void test_applemidi_plays_late_packets_on_arrival(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    __real_applemidi_setJitterBufferCap(100);
+
+    wraps_scheduler_setTimestamp(1000);
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(1, 0, 0x48);
+
+    wraps_scheduler_setTimestamp(1150);
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    processNoteAt(2, 100, 0x49);
+}
+
+static void test_applemidi_holds_early_packets_until_mean_transit_time(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    __real_applemidi_setJitterBufferCap(100);
+
+    wraps_scheduler_setTimestamp(1000);
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(1, 0, 0x48);
+
+    wraps_scheduler_setTimestamp(1090);
+    processNoteAt(2, 100, 0x49);
+
+    advanceTime(9);
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    advanceTime(1);
+}
+
+static void test_applemidi_plays_events_of_sessions_in_due_order(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    start_session(REMOTE_IP_2, 0x12345678);
+    __real_applemidi_setJitterBufferCap(100);
+
+    wraps_scheduler_setTimestamp(1000);
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(1, 0, 0x48);
+
+    wraps_scheduler_setTimestamp(1090);
+    processNoteAt(2, 100, 0x49);
+
+    wraps_scheduler_setTimestamp(1095);
+    processSessionNoteAt(0x12345678, 1, 0, 0x50);
+
+    expect_midi_emit_trio(0x90, 0x50, 0x7f);
+    advanceTime(1);
+
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    advanceTime(4);
+}
+
+static void test_applemidi_adds_jitter_margin_up_to_cap(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    __real_applemidi_setJitterBufferCap(50);
+
+    for (u8 i = 1; i <= 8; i++) {
+        u32 arrival = i * 1000;
+        wraps_scheduler_setTimestamp(arrival);
+        expect_midi_emit_trio(0x90, 0x48, 0x7f);
+        processNoteAt(i, arrival - 1000 + (i % 2 ? 100 : -100), 0x48);
+        advanceTime(100);
+    }
+
+    wraps_scheduler_setTimestamp(20000);
+    processNoteAt(9, 20000 - 900, 0x49);
+
+    advanceTime(49);
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    advanceTime(1);
+}
+
+static void processNoteOffJournal(u16 seqNum)
+{
+    char journalPacket[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ seqNum >> 8, seqNum,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x50, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x40,
+        /* journal header */ 0x20, 0x00, 0x10,
+        /* channel journal (chan 0, N) */ 0x00, 0x06, 0x08,
+        /* chapter N */ 0x00, 0x99, /* off bits */ 0x80 };
+
+    mw_err err = processMidiPacket(journalPacket, sizeof(journalPacket));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_recovers_after_sequence_number_zero(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(0, 0, 0x48);
+
+    expect_midi_emit_trio(0x80, 0x48, 0x00);
+    processNoteOffJournal(2);
+}
+
+static void test_applemidi_recovers_across_sequence_number_wrap(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(0xFFFF, 0, 0x48);
+
+    expect_midi_emit_trio(0x80, 0x48, 0x00);
+    processNoteOffJournal(1);
+}
+
+static void test_applemidi_ignores_duplicate_packets(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(0x10, 0, 0x48);
+
+    processNoteAt(0x10, 0, 0x48);
+}
+
+static void test_applemidi_ignores_late_packets(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(0x10, 0, 0x48);
+    processNoteOffJournal(0x0F);
+
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    processNoteAt(0x11, 0, 0x49);
+    assert_int_equal(applemidi_lastSequenceNumber(), 0x11);
+}
+
+static void test_applemidi_restarts_sequence_on_reinvite(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(0x1000, 0, 0x48);
+
+    start_session(REMOTE_IP, 0xac67e108);
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    processNoteAt(0x10, 0, 0x49);
+}
+
+static void test_applemidi_does_not_track_sequence_without_session(
+    UNUSED void** state)
+{
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processSessionNoteAt(0x11111111, 0x10, 0, 0x48);
+
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    processSessionNoteAt(0x22222222, 0x10, 0, 0x49);
+}
+
+static void test_applemidi_stops_parsing_at_invalid_delta(UNUSED void** state)
+{
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x0B, 0x90, 0x48, 0x6f,
+        /* delta too long */ 0x81, 0x81, 0x81, 0x81, 0x01, 0x80, 0x48, 0x00 };
+
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_rejects_truncated_rtpmidi_packet(
+    UNUSED void** state)
+{
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x0A, 0xF0, 0x01, 0x02 };
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, ERR_RTP_MIDI_PKT_TOO_SMALL);
+
+    err = processMidiPacket(rtp_packet, RTP_MIDI_HEADER_LEN);
+    assert_int_equal(err, ERR_RTP_MIDI_PKT_TOO_SMALL);
+}
+
+static void test_applemidi_ignores_sysex_without_terminator(
+    UNUSED void** state)
+{
+    char rtp_packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x8c, 0x24,
+        /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67, 0xe1,
+        0x08, /* MIDI command section */ 0x03, 0xF0, 0x01, 0x02,
+        /* beyond command section */ 0xF7 };
+
+    mw_err err = processMidiPacket(rtp_packet, sizeof(rtp_packet));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+#define TIMESTAMP(t)                                                           \
+    0, 0, 0, 0, (u8)((t) >> 24), (u8)((t) >> 16), (u8)((t) >> 8), (u8)(t)
+
+static void syncClock(u8 count, u32 ts1, u32 ts2, u32 ts3)
+{
+    char packet[TIMESYNC_PKT_LEN] = { 0xFF, 0xFF, 'C', 'K',
+        /* SSRC */ 0xac, 0x67, 0xe1, 0x08, count, /* padding */ 0, 0, 0,
+        TIMESTAMP(ts1), TIMESTAMP(ts2), TIMESTAMP(ts3) };
+    mw_err err = processMidiPacket(packet, sizeof(packet));
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_responds_to_timestamp_sync(UNUSED void** state)
+{
+    const u8 response[TIMESYNC_PKT_LEN] = { 0xFF, 0xFF, 'C', 'K',
+        /* SSRC */ 0x9E, 0x91, 0x51, 0x50, /* count */ 1, 0, 0, 0,
+        TIMESTAMP(0x11223344), TIMESTAMP(0x1234), TIMESTAMP(0) };
+    wraps_scheduler_setTimestamp(0x1234);
+
+    expect_value(__wrap_comm_megawifi_queueSend, ch, CH_MIDI_PORT);
+    expect_value(__wrap_comm_megawifi_queueSend, remoteIp, REMOTE_IP);
+    expect_value(__wrap_comm_megawifi_queueSend, remotePort, REMOTE_MIDI_PORT);
+    expect_memory(
+        __wrap_comm_megawifi_queueSend, payload, response, sizeof(response));
+    expect_value(__wrap_comm_megawifi_queueSend, len, TIMESYNC_PKT_LEN);
+
+    syncClock(0, 0x11223344, 0, 0);
+}
+
+static void test_applemidi_estimates_clock_offset_and_latency(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    assert_false(applemidi_isClockSynced(0xac67e108));
+
+    syncClock(2, 1000, 500, 1100);
+    assert_true(applemidi_isClockSynced(0xac67e108));
+    assert_int_equal(applemidi_clockOffset(0xac67e108), 550);
+    assert_int_equal(applemidi_latency(0xac67e108), 50);
+
+    syncClock(2, 2000, 1500, 2140);
+    assert_int_equal(applemidi_clockOffset(0xac67e108), 555);
+    assert_int_equal(applemidi_latency(0xac67e108), 55);
+}
+
+static void test_applemidi_starts_playout_from_clock_estimates(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    syncClock(2, 1000, 500, 1100);
+    __real_applemidi_setJitterBufferCap(100);
+
+    wraps_scheduler_setTimestamp(1000);
+    expect_midi_emit_trio(0x90, 0x48, 0x7f);
+    processNoteAt(1, 1400, 0x48);
+
+    wraps_scheduler_setTimestamp(1050);
+    processNoteAt(2, 1550, 0x49);
+
+    advanceTime(23);
+    expect_midi_emit_trio(0x90, 0x49, 0x7f);
+    advanceTime(1);
+}
+
+static void expect_rtpmidi_packet(u32 ip, const u8* packet, u16 length)
+{
+    expect_value(__wrap_comm_megawifi_queueSend, ch, CH_MIDI_PORT);
+    expect_value(__wrap_comm_megawifi_queueSend, remoteIp, ip);
+    expect_value(__wrap_comm_megawifi_queueSend, remotePort, REMOTE_MIDI_PORT);
+    expect_memory(__wrap_comm_megawifi_queueSend, payload, packet, length);
+    expect_value(__wrap_comm_megawifi_queueSend, len, length);
+}
+
+static void writeMidi(const u8* data, u16 length)
+{
+    for (u16 i = 0; i < length; i++) {
+        assert_true(rtpmidi_canWrite());
+        rtpmidi_write(data[i]);
+    }
+}
+
+static void test_applemidi_sends_midi_written_in_tick_as_one_packet(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    wraps_scheduler_setTimestamp(0x1234);
+
+    const u8 midi[] = { 0x90, 0x48, 0x6f, 0x48, 0x00, 0xB0, 0x07, 0x64 };
+    const u8 packet[] = { /* V P X CC M PT */ 0x80, 0x61,
+        /* sequence number */ 0x00, 0x00,
+        /* timestamp */ 0x00, 0x00, 0x12, 0x34, /* SSRC */ 0x9E, 0x91, 0x51,
+        0x50, /* MIDI command section */ 0x0B, 0x90, 0x48, 0x6f, 0x00, 0x90,
+        0x48, 0x00, 0x00, 0xB0, 0x07, 0x64 };
+    writeMidi(midi, sizeof(midi));
+
+    expect_rtpmidi_packet(REMOTE_IP, packet, sizeof(packet));
+    rtpmidi_flush();
+
+    rtpmidi_flush();
+}
+
+static void test_applemidi_increments_sent_sequence_number(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    const u8 midi[] = { 0xC0, 0x05 };
+    for (u8 i = 0; i < 3; i++) {
+        const u8 packet[] = { 0x80, 0x61, /* sequence number */ 0x00, i, 0x00,
+            0x00, 0x00, 0x00, 0x9E, 0x91, 0x51, 0x50, 0x02, 0xC0, 0x05 };
+        writeMidi(midi, sizeof(midi));
+
+        expect_rtpmidi_packet(REMOTE_IP, packet, sizeof(packet));
+        rtpmidi_flush();
+    }
+}
+
+static void test_applemidi_sends_midi_to_all_sessions(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    start_session(REMOTE_IP_2, 0x12345678);
+
+    const u8 midi[] = { 0xF0, 0x00, 0x22, 0x77, 0x02, 0xF7 };
+    const u8 packet[] = { 0x80, 0x61, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x9E, 0x91, 0x51, 0x50, sizeof(midi), 0xF0, 0x00, 0x22, 0x77, 0x02,
+        0xF7 };
+    writeMidi(midi, sizeof(midi));
+
+    expect_rtpmidi_packet(REMOTE_IP, packet, sizeof(packet));
+    expect_rtpmidi_packet(REMOTE_IP_2, packet, sizeof(packet));
+    rtpmidi_flush();
+}
+
+static void test_applemidi_splits_long_sysex_across_packets(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    u8 first[COMM_MEGAWIFI_SEND_MAX_LEN] = { 0x80, 0x61, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x9E, 0x91, 0x51, 0x50 };
+    u16 firstLength = RTP_MIDI_HEADER_LEN + 2;
+    first[firstLength++] = 0xF0;
+    rtpmidi_write(0xF0);
+    while (rtpmidi_canWrite()) {
+        first[firstLength++] = 0x01;
+        rtpmidi_write(0x01);
+    }
+    first[firstLength++] = 0xF0;
+    u16 midiLength = firstLength - RTP_MIDI_HEADER_LEN - 2;
+    first[RTP_MIDI_HEADER_LEN] = 0x80 | (midiLength >> 8);
+    first[RTP_MIDI_HEADER_LEN + 1] = midiLength;
+
+    expect_rtpmidi_packet(REMOTE_IP, first, firstLength);
+    rtpmidi_flush();
+
+    const u8 last[] = { 0x80, 0x61, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x9E,
+        0x91, 0x51, 0x50, 0x03, 0xF7, 0x02, 0xF7 };
+    rtpmidi_write(0x02);
+    rtpmidi_write(0xF7);
+
+    expect_rtpmidi_packet(REMOTE_IP, last, sizeof(last));
+    rtpmidi_flush();
+}
+
+static void processSessionCommands(
+    u32 ssrc, u16 seqNum, const u8* commands, u16 length)
+{
+    char packet[RTP_MIDI_HEADER_LEN + 2 + 300] = { /* V P X CC M PT */ 0x80,
+        0x61, (u8)(seqNum >> 8), (u8)seqNum, /* timestamp */ 0x00, 0x58, 0xbb,
+        0x40, /* SSRC */ (u8)(ssrc >> 24), (u8)(ssrc >> 16), (u8)(ssrc >> 8),
+        (u8)ssrc, /* MIDI command section */ (u8)(0x80 | (length >> 8)),
+        (u8)length };
+    memcpy(&packet[RTP_MIDI_HEADER_LEN + 2], commands, length);
+    mw_err err
+        = processMidiPacket(packet, RTP_MIDI_HEADER_LEN + 2 + length);
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void processCommands(u16 seqNum, const u8* commands, u16 length)
+{
+    processSessionCommands(0xac67e108, seqNum, commands, length);
+}
+
+static void test_applemidi_keeps_later_events_of_other_sessions_at_sysex(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    start_session(REMOTE_IP_2, 0x12345678);
+    __real_applemidi_setJitterBufferCap(100);
+
+    wraps_scheduler_setTimestamp(1000);
+    expect_midi_emit_trio(0x90, 0x50, 0x7f);
+    processSessionNoteAt(0x12345678, 1, 0, 0x50);
+
+    wraps_scheduler_setTimestamp(1090);
+    processSessionNoteAt(0x12345678, 2, 100, 0x51);
+
+    wraps_scheduler_setTimestamp(1095);
+    const u8 sysex[] = { 0xF0, 0x01, 0xF7 };
+    expect_midi_emit_trio(0xF0, 0x01, 0xF7);
+    processSessionCommands(0xac67e108, 1, sysex, sizeof(sysex));
+
+    expect_midi_emit_trio(0x90, 0x51, 0x7f);
+    advanceTime(5);
+}
+
+static void test_applemidi_reassembles_sysex_segments_across_packets(
+    UNUSED void** state)
+{
+    const u8 first[] = { 0xF0, 0x12, 0x34, 0xF0 };
+    const u8 middle[] = { 0xF7, 0x56, 0xF0 };
+    const u8 last[] = { 0xF7, 0x78, 0xF7, 0x00, 0x90, 0x48, 0x6f };
+
+    processCommands(1, first, sizeof(first));
+    processCommands(2, middle, sizeof(middle));
+
+    expect_midi_emit(0xF0);
+    expect_midi_emit(0x12);
+    expect_midi_emit(0x34);
+    expect_midi_emit(0x56);
+    expect_midi_emit(0x78);
+    expect_midi_emit(0xF7);
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    processCommands(3, last, sizeof(last));
+}
+
+static void test_applemidi_reassembles_sysex_of_each_session_separately(
+    UNUSED void** state)
+{
+    const u8 first[] = { 0xF0, 0x12, 0xF0 };
+    const u8 otherFirst[] = { 0xF0, 0x34, 0xF0 };
+    const u8 last[] = { 0xF7, 0x56, 0xF7 };
+    const u8 otherLast[] = { 0xF7, 0x78, 0xF7 };
+    start_session(REMOTE_IP, 0xac67e108);
+    start_session(REMOTE_IP_2, 0x12345678);
+
+    processSessionCommands(0xac67e108, 1, first, sizeof(first));
+    processSessionCommands(0x12345678, 1, otherFirst, sizeof(otherFirst));
+
+    expect_midi_emit(0xF0);
+    expect_midi_emit(0x12);
+    expect_midi_emit(0x56);
+    expect_midi_emit(0xF7);
+    processSessionCommands(0xac67e108, 2, last, sizeof(last));
+
+    expect_midi_emit(0xF0);
+    expect_midi_emit(0x34);
+    expect_midi_emit(0x78);
+    expect_midi_emit(0xF7);
+    processSessionCommands(0x12345678, 2, otherLast, sizeof(otherLast));
+}
+
+static void test_applemidi_drops_sysex_after_lost_segment(UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+
+    const u8 first[] = { 0xF0, 0x12, 0xF0 };
+    const u8 last[] = { 0xF7, 0x78, 0xF7 };
+
+    processCommands(1, first, sizeof(first));
+    processCommands(3, last, sizeof(last));
+}
+
+static void test_applemidi_drops_cancelled_sysex(UNUSED void** state)
+{
+    const u8 first[] = { 0xF0, 0x12, 0xF0 };
+    const u8 cancel[] = { 0xF7, 0x34, 0xF4 };
+    const u8 last[] = { 0xF7, 0x78, 0xF7 };
+
+    processCommands(1, first, sizeof(first));
+    processCommands(2, cancel, sizeof(cancel));
+    processCommands(3, last, sizeof(last));
+}
+
+static void test_applemidi_drops_sysex_longer_than_buffer(UNUSED void** state)
+{
+    u8 segment[200];
+    memset(segment, 0x01, sizeof(segment));
+    segment[0] = 0xF0;
+    segment[sizeof(segment) - 1] = 0xF0;
+    processCommands(1, segment, sizeof(segment));
+
+    segment[0] = 0xF7;
+    segment[sizeof(segment) - 1] = 0xF7;
+    processCommands(2, segment, sizeof(segment));
+}
+
+static void processNoteWithJournal(u16 seqNum, u16 journalLength)
+{
+    char packet[RTP_MIDI_HEADER_LEN + 4 + RECEIVER_FEEDBACK_JOURNAL_LEN]
+        = { /* V P X CC M PT */ 0x80, 0x61, (u8)(seqNum >> 8), (u8)seqNum,
+              /* timestamp */ 0x00, 0x58, 0xbb, 0x40, /* SSRC */ 0xac, 0x67,
+              0xe1, 0x08, /* MIDI command section */
+              (u8)(journalLength ? 0x43 : 0x03), 0x90, 0x48, 0x6f };
+    expect_midi_emit_trio(0x90, 0x48, 0x6f);
+    mw_err err
+        = processMidiPacket(packet, RTP_MIDI_HEADER_LEN + 4 + journalLength);
+    assert_int_equal(err, MW_ERR_NONE);
+}
+
+static void test_applemidi_sends_receiver_feedback_once_idle(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    processNoteWithJournal(1, 0);
+
+    applemidi_sendReceiverFeedback(RECEIVER_FEEDBACK_MIN_FRAMES, false);
+    applemidi_sendReceiverFeedback(RECEIVER_FEEDBACK_MIN_FRAMES - 1, false);
+
+    expect_receiver_feedback(REMOTE_IP, 1);
+    applemidi_sendReceiverFeedback(1, true);
+}
+
+static void test_applemidi_holds_receiver_feedback_while_busy(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    processNoteWithJournal(1, 0);
+
+    for (u16 i = 1; i < RECEIVER_FEEDBACK_MAX_FRAMES; i++) {
+        applemidi_sendReceiverFeedback(1, false);
+    }
+
+    expect_receiver_feedback(REMOTE_IP, 1);
+    applemidi_sendReceiverFeedback(1, false);
+    applemidi_sendReceiverFeedback(RECEIVER_FEEDBACK_MAX_FRAMES, true);
+}
+
+static void test_applemidi_sends_receiver_feedback_after_many_packets(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    for (u16 seqNum = 1; seqNum < RECEIVER_FEEDBACK_MAX_PACKETS; seqNum++) {
+        processNoteWithJournal(seqNum, 0);
+        applemidi_sendReceiverFeedback(0, false);
+    }
+
+    processNoteWithJournal(RECEIVER_FEEDBACK_MAX_PACKETS, 0);
+    expect_receiver_feedback(REMOTE_IP, RECEIVER_FEEDBACK_MAX_PACKETS);
+    applemidi_sendReceiverFeedback(0, false);
+}
+
+static void test_applemidi_sends_receiver_feedback_early_for_large_journal(
+    UNUSED void** state)
+{
+    start_session(REMOTE_IP, 0xac67e108);
+    processNoteWithJournal(1, RECEIVER_FEEDBACK_JOURNAL_LEN - 1);
+    applemidi_sendReceiverFeedback(1, false);
+
+    processNoteWithJournal(2, RECEIVER_FEEDBACK_JOURNAL_LEN);
+    expect_receiver_feedback(REMOTE_IP, 2);
+    applemidi_sendReceiverFeedback(1, false);
+}
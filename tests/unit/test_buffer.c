@@ -84,3 +84,127 @@ static void test_buffer_returns_can_write_if_empty(UNUSED void** state)
 {
     assert_int_equal(buffer_canWrite(), true);
 }
+
+static void writeBytes(const u8* data, u16 length)
+{
+    for (u16 i = 0; i < length; i++) {
+        buffer_write(data[i]);
+    }
+}
+
+static void assert_reads(const u8* expected, u16 length)
+{
+    for (u16 i = 0; i < length; i++) {
+        assert_true(buffer_canRead());
+        assert_int_equal(buffer_read(), expected[i]);
+    }
+}
+
+static void test_buffer_reads_notes_before_earlier_sysex(UNUSED void** state)
+{
+    const u8 sysex[] = { 0xF0, 0x01, 0x02, 0xF7 };
+    const u8 note[] = { 0x90, 0x3C, 0x64 };
+    writeBytes(sysex, sizeof(sysex));
+    writeBytes(note, sizeof(note));
+
+    assert_reads(note, sizeof(note));
+    assert_reads(sysex, sizeof(sysex));
+    assert_false(buffer_canRead());
+}
+
+static void test_buffer_does_not_read_incomplete_sysex(UNUSED void** state)
+{
+    buffer_write(0xF0);
+    buffer_write(0x01);
+    assert_false(buffer_canRead());
+
+    buffer_write(0xF7);
+    const u8 sysex[] = { 0xF0, 0x01, 0xF7 };
+    assert_reads(sysex, sizeof(sysex));
+}
+
+static void test_buffer_reads_sysex_only_between_messages(UNUSED void** state)
+{
+    const u8 sysex[] = { 0xF0, 0x01, 0xF7 };
+    const u8 partialNote[] = { 0x90, 0x3C };
+    writeBytes(sysex, sizeof(sysex));
+    writeBytes(partialNote, sizeof(partialNote));
+
+    assert_reads(partialNote, sizeof(partialNote));
+    assert_false(buffer_canRead());
+
+    buffer_write(0x64);
+    assert_int_equal(buffer_read(), 0x64);
+    assert_reads(sysex, sizeof(sysex));
+}
+
+static void test_buffer_reads_realtime_within_sysex_first(UNUSED void** state)
+{
+    const u8 written[] = { 0xF0, 0x01, 0xF8, 0x02, 0xF7 };
+    const u8 read[] = { 0xF8, 0xF0, 0x01, 0x02, 0xF7 };
+    writeBytes(written, sizeof(written));
+
+    assert_reads(read, sizeof(read));
+}
+
+static void test_buffer_drops_sysex_larger_than_queue(UNUSED void** state)
+{
+    buffer_write(0xF0);
+    for (u16 i = 0; i < BUFFER_SYSEX_SIZE; i++) {
+        buffer_write(0x01);
+    }
+    buffer_write(0xF7);
+    assert_false(buffer_canRead());
+    assert_int_equal(buffer_sysexAvailable(), BUFFER_SYSEX_SIZE);
+
+    const u8 sysex[] = { 0xF0, 0x02, 0xF7 };
+    writeBytes(sysex, sizeof(sysex));
+    assert_reads(sysex, sizeof(sysex));
+}
+
+static void test_buffer_reads_sysex_between_notes_of_busy_queue(
+    UNUSED void** state)
+{
+    const u8 sysex[] = { 0xF0, 0x01, 0xF7 };
+    const u8 note[] = { 0x90, 0x3C, 0x64 };
+    const u16 notesPerSlice = (BUFFER_SYSEX_SLICE + 2) / sizeof(note);
+    writeBytes(sysex, sizeof(sysex));
+    for (u16 i = 0; i < notesPerSlice + 1; i++) {
+        writeBytes(note, sizeof(note));
+    }
+
+    for (u16 i = 0; i < notesPerSlice; i++) {
+        assert_reads(note, sizeof(note));
+    }
+    assert_reads(sysex, sizeof(sysex));
+    assert_reads(note, sizeof(note));
+    assert_false(buffer_canRead());
+}
+
+static void test_buffer_suspends_long_sysex_for_notes(UNUSED void** state)
+{
+    const u16 sysexDataLength = BUFFER_SYSEX_SLICE + 10;
+    const u8 note[] = { 0x90, 0x3C, 0x64 };
+    buffer_write(0xF0);
+    for (u16 i = 0; i < sysexDataLength; i++) {
+        buffer_write(0x01);
+    }
+    buffer_write(0xF7);
+
+    assert_int_equal(buffer_read(), 0xF0);
+    for (u16 i = 1; i < BUFFER_SYSEX_SLICE; i++) {
+        assert_int_equal(buffer_read(), 0x01);
+    }
+    assert_false(buffer_sysexSuspended());
+
+    writeBytes(note, sizeof(note));
+    assert_true(buffer_sysexSuspended());
+    assert_reads(note, sizeof(note));
+    assert_false(buffer_sysexSuspended());
+
+    for (u16 i = BUFFER_SYSEX_SLICE; i <= sysexDataLength; i++) {
+        assert_int_equal(buffer_read(), 0x01);
+    }
+    assert_int_equal(buffer_read(), 0xF7);
+    assert_false(buffer_canRead());
+}
@@ -32,6 +32,24 @@ static void test_comm_reads_from_serial_when_ready(UNUSED void** state)
     assert_int_equal(read, 50);
 }
 
+static void test_comm_reports_sysex_queued_by_serial(UNUSED void** state)
+{
+    will_return(__wrap_comm_everdrive_readReady, 0);
+    will_return(__wrap_comm_everdrive_pro_readReady, 0);
+    will_return(__wrap_comm_serial_readReady, 1);
+    will_return(__wrap_comm_serial_read, 50);
+    __real_comm_read();
+
+    assert_true(__real_comm_sysexQueued());
+}
+
+static void test_comm_reports_sysex_inline_for_everdrive(UNUSED void** state)
+{
+    switch_comm_type_to_everdrive();
+
+    assert_false(__real_comm_sysexQueued());
+}
+
 static void test_comm_reads_when_ready(UNUSED void** state)
 {
     will_return(__wrap_comm_everdrive_readReady, 0);
@@ -53,11 +71,68 @@ static void test_comm_writes_when_ready(UNUSED void** state)
     will_return(__wrap_comm_everdrive_read, 50);
     __real_comm_read();
 
+    __real_comm_write(test_data);
+
     will_return(__wrap_comm_everdrive_writeReady, 0);
+    __real_comm_flush();
+
     will_return(__wrap_comm_everdrive_writeReady, 1);
     expect_value(__wrap_comm_everdrive_write, data, test_data);
+    __real_comm_flush();
+}
+
+static void test_comm_queues_writes_until_comm_type_is_known(
+    UNUSED void** state)
+{
+    const u8 test_data = 50;
 
     __real_comm_write(test_data);
+    __real_comm_flush();
+
+    will_return(__wrap_comm_everdrive_readReady, 1);
+    will_return(__wrap_comm_everdrive_read, 50);
+    __real_comm_read();
+
+    will_return(__wrap_comm_everdrive_writeReady, 1);
+    expect_value(__wrap_comm_everdrive_write, data, test_data);
+    __real_comm_flush();
+}
+
+static void test_comm_reports_space_left_to_write(UNUSED void** state)
+{
+    assert_int_equal(__real_comm_writeAvailable(), 256);
+
+    __real_comm_write(50);
+
+    assert_int_equal(__real_comm_writeAvailable(), 255);
+}
+
+static void test_comm_warns_once_when_dropping_writes(UNUSED void** state)
+{
+    wraps_enable_logging_checks();
+    for (u16 i = 0; i < 256; i++) {
+        __real_comm_write(50);
+    }
+    assert_int_equal(__real_comm_writeAvailable(), 0);
+
+    expect_log_warn("Comm: TX buffer full");
+    for (u16 i = 0; i < 10; i++) {
+        __real_comm_write(50);
+    }
+    wraps_disable_logging_checks();
+    __real_comm_init();
+}
+
+static void test_comm_flushes_writes_of_active_transport(UNUSED void** state)
+{
+    will_return(__wrap_comm_everdrive_readReady, 0);
+    will_return(__wrap_comm_everdrive_pro_readReady, 1);
+    will_return(__wrap_comm_everdrive_pro_read, 50);
+    __real_comm_read();
+
+    expect_function_call(__wrap_comm_everdrive_pro_flush);
+
+    __real_comm_flush();
 }
 
 static void test_comm_idle_count_is_correct(UNUSED void** state)
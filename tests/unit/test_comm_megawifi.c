@@ -6,8 +6,18 @@
 #include "mw/mpool.h"
 #include "mw/util.h"
 #include "buffer.h"
+#include <memory.h>
+#include <stddef.h>
 
 extern void __real_comm_megawifi_init(void);
+extern void __real_comm_megawifi_tick(void);
+extern char* __real_comm_megawifi_reserveSend(void);
+extern void __real_comm_megawifi_queueSend(
+    u8 ch, u32 remoteIp, u16 remotePort, char* payload, u16 len);
+extern void send_complete_cb(enum lsd_status stat, void* ctx);
+
+#define REMOTE_IP 0xC0A80102
+#define REMOTE_PORT 5004
 
 static int test_comm_megawifi_setup(UNUSED void** state)
 {
@@ -16,20 +26,11 @@ static int test_comm_megawifi_setup(UNUSED void** state)
     return 0;
 }
 
-#define expect_udp_port_open(c, s_port)                                        \
-    do {                                                                       \
-        expect_value(__wrap_mw_udp_set, ch, c);                                \
-        expect_value(__wrap_mw_udp_set, dst_addr, NULL);                       \
-        expect_value(__wrap_mw_udp_set, dst_port, NULL);                       \
-        expect_memory(__wrap_mw_udp_set, src_port, s_port, sizeof(s_port));    \
-        will_return(__wrap_mw_udp_set, MW_ERR_NONE);                           \
-    } while (0)
-
-static void expect_mw_init(void)
+static void expect_mw_init(mw_err result)
 {
     expect_any(__wrap_mw_init, cmd_buf);
     expect_any(__wrap_mw_init, buf_len);
-    will_return(__wrap_mw_init, MW_ERR_NONE);
+    will_return(__wrap_mw_init, result);
 
     expect_value(__wrap_loop_init, max_func, 2);
     expect_value(__wrap_loop_init, max_timer, 4);
@@ -39,39 +40,170 @@ static void expect_mw_init(void)
     will_return(__wrap_loop_func_add, MW_ERR_NONE);
 }
 
-static void expect_mw_detect(void)
+static void expect_lsd_send(u8 c, u16 length)
+{
+    expect_value(__wrap_lsd_send, ch, c);
+    expect_any(__wrap_lsd_send, data);
+    expect_value(__wrap_lsd_send, len, length);
+    expect_value(__wrap_lsd_send, ctx, NULL);
+    expect_any(__wrap_lsd_send, send_cb);
+    will_return(__wrap_lsd_send, LSD_STAT_BUSY);
+}
+
+static LargestIntegralType postedRecvBuffer;
+static LargestIntegralType postedRecvCallback;
+
+static int capture(
+    const LargestIntegralType value, const LargestIntegralType destination)
+{
+    *(LargestIntegralType*)destination = value;
+    return 1;
+}
+
+static void expect_lsd_recv(u16 length)
+{
+    expect_check(__wrap_lsd_recv, buf, capture, &postedRecvBuffer);
+    expect_value(__wrap_lsd_recv, len, length);
+    expect_value(__wrap_lsd_recv, ctx, NULL);
+    expect_check(__wrap_lsd_recv, recv_cb, capture, &postedRecvCallback);
+    will_return(__wrap_lsd_recv, LSD_STAT_BUSY);
+}
+
+static PtResult runTask(void)
+{
+    SchedulerTask* task = wraps_scheduler_addedTask();
+    return task->run(&task->pt);
+}
+
+static void runFrames(u16 frames)
+{
+    for (u16 i = 0; i < frames; i++) {
+        comm_megawifi_vsync();
+        runTask();
+    }
+}
+
+#define COMMAND_HEADER_LEN 4
+#define UDP_SET_LEN (COMMAND_HEADER_LEN + sizeof(struct mw_msg_in_addr) + 1)
+
+static LargestIntegralType sentCommand;
+
+static void expect_command_of_length(u16 length)
+{
+    expect_value(__wrap_lsd_send, ch, MW_CTRL_CH);
+    expect_check(__wrap_lsd_send, data, capture, &sentCommand);
+    expect_value(__wrap_lsd_send, len, length);
+    expect_value(__wrap_lsd_send, ctx, NULL);
+    expect_any(__wrap_lsd_send, send_cb);
+    will_return(__wrap_lsd_send, LSD_STAT_BUSY);
+    expect_lsd_recv(sizeof(mw_cmd));
+    expect_function_call(__wrap_mw_process);
+}
+
+static void expect_command(void)
 {
-    mock_mw_detect(3, 1);
-    will_return(__wrap_mw_detect, MW_ERR_NONE);
+    expect_command_of_length(COMMAND_HEADER_LEN);
+}
+
+static void assert_command_sent(u16 cmd)
+{
+    assert_int_equal(((mw_cmd*)sentCommand)->cmd, cmd);
+}
+
+static void replyToCommand(mw_cmd* reply)
+{
+    reply->cmd = MW_CMD_OK;
+    lsd_recv_cb callback = (lsd_recv_cb)postedRecvCallback;
+    callback(LSD_STAT_COMPLETE, MW_CTRL_CH, reply->packet, 4, NULL);
+    expect_function_call(__wrap_mw_process);
+}
+
+static void bootModule(void)
+{
+    expect_mw_init(MW_ERR_NONE);
+    expect_function_call(__wrap_scheduler_addTask);
+    __real_comm_megawifi_init();
+    runTask();
+
+    expect_function_call(__wrap_mw_start);
+    runFrames(MS_TO_FRAMES(30));
+    expect_function_call(__wrap_mw_reset_fifos);
+    expect_command();
+    runFrames(MS_TO_FRAMES(1000));
+    assert_command_sent(MW_CMD_VERSION);
+}
+
+static void detectModule(void)
+{
+    static mw_cmd version;
+    version.data[0] = 3;
+    version.data[1] = 1;
     expect_log_info("MW: Detected v%d.%d");
+    expect_command_of_length(COMMAND_HEADER_LEN + 1);
+    replyToCommand(&version);
+    runTask();
+    assert_command_sent(MW_CMD_AP_JOIN);
+    assert_int_equal(((mw_cmd*)sentCommand)->data[0], 0);
+
+    static mw_cmd joined;
+    expect_command();
+    replyToCommand(&joined);
+    runTask();
+    assert_command_sent(MW_CMD_SYS_STAT);
 }
 
-static void expect_ap_connection(void)
+static void replyWithSystemState(enum mw_state state)
 {
-    expect_value(__wrap_mw_ap_assoc, slot, 0);
-    will_return(__wrap_mw_ap_assoc, MW_ERR_NONE);
+    static mw_cmd status;
+    status.sys_stat.sys_stat = state;
+    replyToCommand(&status);
+    runTask();
+}
 
-    expect_any(__wrap_mw_ap_assoc_wait, tout_frames);
-    will_return(__wrap_mw_ap_assoc_wait, MW_ERR_NONE);
+static void assert_udp_set_sent(u8 ch, const char* srcPort)
+{
+    mw_cmd* command = (mw_cmd*)sentCommand;
+    assert_int_equal(command->cmd, MW_CMD_UDP_SET);
+    assert_int_equal(command->in_addr.channel, ch);
+    assert_string_equal(command->in_addr.src_port, srcPort);
+    assert_string_equal(command->in_addr.dst_port, "");
+    assert_string_equal(command->in_addr.dst_addr, "");
 }
 
-static void expect_ip_log(void)
+static void openUdpPorts(void)
 {
-    mock_ip_cfg(ip_str_to_uint32("127.1.2.3"));
-    will_return(__wrap_mw_ip_current, MW_ERR_NONE);
+    static mw_cmd ipConfig;
+    ipConfig.ip_cfg.ip.addr.addr = ip_str_to_uint32("127.1.2.3");
     expect_log_info("MW: IP: %s");
+    expect_command_of_length(UDP_SET_LEN);
+    replyToCommand(&ipConfig);
+    runTask();
+    assert_udp_set_sent(CH_CONTROL_PORT, "5006");
+
+    static mw_cmd opened;
+    expect_command_of_length(UDP_SET_LEN);
+    replyToCommand(&opened);
+    runTask();
+    assert_udp_set_sent(CH_MIDI_PORT, "5007");
+
+    expect_log_info("MW: Listening on UDP %d");
+    replyToCommand(&opened);
+    runTask();
+}
+
+static void associate(void)
+{
+    expect_command();
+    replyWithSystemState(MW_ST_READY);
+    assert_command_sent(MW_CMD_IP_CURRENT);
 }
 
 static void megawifi_init(void)
 {
-    expect_mw_init();
-    expect_mw_detect();
-    expect_ap_connection();
-    expect_ip_log();
-    expect_udp_port_open(CH_CONTROL_PORT, "5006");
-    expect_udp_port_open(CH_MIDI_PORT, "5007");
-    expect_log_info("MW: Listening on UDP %d");
-    __real_comm_megawifi_init();
+    bootModule();
+    detectModule();
+    associate();
+    openUdpPorts();
 }
 
 static void test_comm_megawifi_initialises(UNUSED void** state)
@@ -79,6 +211,94 @@ static void test_comm_megawifi_initialises(UNUSED void** state)
     megawifi_init();
 }
 
+static void test_comm_megawifi_polls_status_until_associated(
+    UNUSED void** state)
+{
+    bootModule();
+    detectModule();
+    replyWithSystemState(MW_ST_AP_JOIN);
+
+    expect_command();
+    runFrames(MS_TO_FRAMES(250));
+
+    associate();
+    openUdpPorts();
+}
+
+static void test_comm_megawifi_stops_if_udp_port_cannot_be_opened(
+    UNUSED void** state)
+{
+    bootModule();
+    detectModule();
+    associate();
+
+    static mw_cmd ipConfig;
+    expect_log_info("MW: IP: %s");
+    expect_command_of_length(UDP_SET_LEN);
+    replyToCommand(&ipConfig);
+    runTask();
+
+    static mw_cmd failed;
+    failed.cmd = MW_CMD_ERROR;
+    expect_log_warn("MW: Cannot open UDP %d");
+    lsd_recv_cb callback = (lsd_recv_cb)postedRecvCallback;
+    callback(LSD_STAT_COMPLETE, MW_CTRL_CH, failed.packet, 4, NULL);
+    expect_function_call(__wrap_mw_process);
+    assert_int_equal(runTask(), PT_ENDED);
+}
+
+static void test_comm_megawifi_ignores_datagram_while_awaiting_reply(
+    UNUSED void** state)
+{
+    bootModule();
+    detectModule();
+    associate();
+
+    static mw_cmd ipConfig;
+    expect_log_info("MW: IP: %s");
+    expect_command_of_length(UDP_SET_LEN);
+    replyToCommand(&ipConfig);
+    runTask();
+
+    static mw_cmd datagram;
+    expect_lsd_recv(sizeof(mw_cmd));
+    lsd_recv_cb callback = (lsd_recv_cb)postedRecvCallback;
+    callback(LSD_STAT_COMPLETE, CH_CONTROL_PORT, datagram.packet, 4, NULL);
+    expect_function_call(__wrap_mw_process);
+    runTask();
+
+    static mw_cmd opened;
+    expect_command_of_length(UDP_SET_LEN);
+    replyToCommand(&opened);
+    runTask();
+    assert_udp_set_sent(CH_MIDI_PORT, "5007");
+}
+
+static void test_comm_megawifi_gives_up_when_module_does_not_reply(
+    UNUSED void** state)
+{
+    const u16 timeoutFrames = MS_TO_FRAMES(1000);
+    bootModule();
+    for (u8 attempt = 1; attempt < 5; attempt++) {
+        expect_function_calls(__wrap_mw_process, timeoutFrames);
+        expect_function_call(__wrap_mw_reset_fifos);
+        expect_command();
+        runFrames(timeoutFrames);
+    }
+    expect_function_calls(__wrap_mw_process, timeoutFrames);
+    runFrames(timeoutFrames - 1);
+
+    comm_megawifi_vsync();
+    assert_int_equal(runTask(), PT_ENDED);
+}
+
+static void test_comm_megawifi_does_not_start_without_uart(
+    UNUSED void** state)
+{
+    expect_mw_init(MW_ERR);
+    __real_comm_megawifi_init();
+}
+
 static void test_comm_megawifi_reads_midi_message(UNUSED void** state)
 {
     megawifi_init();
@@ -89,6 +309,107 @@ static void test_comm_megawifi_logs_if_buffer_full(UNUSED void** state)
     expect_log_warn("MW: MIDI buffer full!");
 
     for (u16 i = 0; i < BUFFER_SIZE + 1; i++) {
-        __real_comm_megawifi_midiEmitCallback(0x00);
+        __real_comm_megawifi_midiEmit(0x00, NULL, 0);
+    }
+}
+
+static void queueSend(u8 ch, char* data, u16 length)
+{
+    char* payload = __real_comm_megawifi_reserveSend();
+    assert_non_null(payload);
+    memcpy(payload, data, length);
+    __real_comm_megawifi_queueSend(ch, REMOTE_IP, REMOTE_PORT, payload, length);
+}
+
+static void test_comm_megawifi_queues_sends_while_send_in_flight(
+    UNUSED void** state)
+{
+    megawifi_init();
+    char data1[] = { 0x01, 0x02, 0x03 };
+    char data2[] = { 0x04, 0x05 };
+
+    expect_lsd_send(CH_CONTROL_PORT, sizeof(data1) + 6);
+    queueSend(CH_CONTROL_PORT, data1, sizeof(data1));
+    queueSend(CH_MIDI_PORT, data2, sizeof(data2));
+
+    expect_lsd_send(CH_MIDI_PORT, sizeof(data2) + 6);
+    send_complete_cb(LSD_STAT_COMPLETE, NULL);
+    send_complete_cb(LSD_STAT_COMPLETE, NULL);
+}
+
+static void test_comm_megawifi_builds_packets_in_place(UNUSED void** state)
+{
+    megawifi_init();
+    char* payload = __real_comm_megawifi_reserveSend();
+    payload[0] = 0x01;
+    payload[1] = 0x02;
+
+    expect_value(__wrap_lsd_send, ch, CH_CONTROL_PORT);
+    expect_value(__wrap_lsd_send, data,
+        payload - offsetof(struct mw_reuse_payload, payload));
+    expect_value(__wrap_lsd_send, len, 2 + 6);
+    expect_value(__wrap_lsd_send, ctx, NULL);
+    expect_any(__wrap_lsd_send, send_cb);
+    will_return(__wrap_lsd_send, LSD_STAT_BUSY);
+    __real_comm_megawifi_queueSend(
+        CH_CONTROL_PORT, REMOTE_IP, REMOTE_PORT, payload, 2);
+}
+
+static void test_comm_megawifi_returns_no_send_buffer_when_queue_full(
+    UNUSED void** state)
+{
+    megawifi_init();
+    for (u8 i = 0; i < 4; i++) {
+        assert_non_null(__real_comm_megawifi_reserveSend());
+    }
+
+    expect_log_warn("MW: Send queue full!");
+    assert_null(__real_comm_megawifi_reserveSend());
+}
+
+static void test_comm_megawifi_receives_while_send_in_flight(
+    UNUSED void** state)
+{
+    megawifi_init();
+    char data[] = { 0x01, 0x02, 0x03 };
+
+    expect_lsd_send(CH_CONTROL_PORT, sizeof(data) + 6);
+    queueSend(CH_CONTROL_PORT, data, sizeof(data));
+
+    expect_function_call(__wrap_mw_process);
+    expect_any(__wrap_lsd_recv, buf);
+    expect_value(__wrap_lsd_recv, len, 1460);
+    expect_value(__wrap_lsd_recv, ctx, NULL);
+    expect_any(__wrap_lsd_recv, recv_cb);
+    will_return(__wrap_lsd_recv, LSD_STAT_BUSY);
+    __real_comm_megawifi_tick();
+
+    expect_function_call(__wrap_mw_process);
+    __real_comm_megawifi_tick();
+}
+
+static void test_comm_megawifi_reads_raw_ipmidi_datagram(UNUSED void** state)
+{
+    const u8 midi[] = { 0x90, 0x40, 0x7F, 0x40, 0x00 };
+    buffer_init();
+    megawifi_init();
+    expect_function_call(__wrap_mw_process);
+    expect_lsd_recv(1460);
+    __real_comm_megawifi_tick();
+
+    struct mw_reuse_payload* udp
+        = (struct mw_reuse_payload*)postedRecvBuffer;
+    udp->remote_ip = REMOTE_IP;
+    udp->remote_port = REMOTE_PORT;
+    memcpy(udp->payload, midi, sizeof(midi));
+    lsd_recv_cb callback = (lsd_recv_cb)postedRecvCallback;
+    expect_lsd_recv(1460);
+    callback(LSD_STAT_COMPLETE, CH_IPMIDI_PORT, (char*)udp,
+        sizeof(midi) + 6, NULL);
+
+    for (u16 i = 0; i < sizeof(midi); i++) {
+        assert_true(comm_megawifi_readReady());
+        assert_int_equal(comm_megawifi_read(), midi[i]);
     }
+    assert_false(comm_megawifi_readReady());
 }
@@ -2,6 +2,7 @@
 #include "cmocka_inc.h"
 
 #include "midi.h"
+#include "midi_bundle.h"
 #include "midi_fm.h"
 #include "midi_psg.h"
 #include "synth.h"
@@ -34,6 +35,8 @@
 #define SYSEX_NON_GENERAL_MIDI_CC_DISABLED 0x00
 #define SYSEX_STICK_TO_DEVICE_TYPE_COMMAND_ID 0x05
 #define SYSEX_LOAD_PSG_ENVELOPE_COMMAND_ID 0x06
+#define SYSEX_JITTER_BUFFER_COMMAND_ID 0x07
+#define SYSEX_BUNDLE_COMMAND_ID 0x08
 
 extern void __real_midi_noteOn(u8 chan, u8 pitch, u8 velocity);
 extern void __real_midi_noteOff(u8 chan, u8 pitch);
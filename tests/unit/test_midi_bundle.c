@@ -0,0 +1,103 @@
+#include "cmocka_inc.h"
+#include "midi_bundle.h"
+#include <memory.h>
+
+static int test_midi_bundle_setup(UNUSED void** state)
+{
+    wraps_scheduler_setTimestamp(1000);
+    midi_bundle_init();
+    return 0;
+}
+
+static void queueBundle(
+    u32 target, u16 lookahead, const u8* events, u16 eventsLength)
+{
+    u8 bundle[BUNDLE_HEADER_LEN + 16] = { (target >> 21) & 0x7F,
+        (target >> 14) & 0x7F, (target >> 7) & 0x7F, target & 0x7F,
+        (lookahead >> 7) & 0x7F, lookahead & 0x7F };
+    memcpy(&bundle[BUNDLE_HEADER_LEN], events, eventsLength);
+    midi_bundle_queue(bundle, BUNDLE_HEADER_LEN + eventsLength);
+}
+
+static void tickAt(u32 timestamp)
+{
+    wraps_scheduler_setTimestamp(timestamp);
+    __real_midi_bundle_tick();
+}
+
+static void expect_note_on(u8 chan, u8 pitch, u8 velocity)
+{
+    expect_value(__wrap_midi_noteOn, chan, chan);
+    expect_value(__wrap_midi_noteOn, pitch, pitch);
+    expect_value(__wrap_midi_noteOn, velocity, velocity);
+}
+
+static void test_midi_bundle_plays_events_at_target_time(UNUSED void** state)
+{
+    const u8 events[] = { 0x10, 0x40, 0x7F, 0x11, 0x43, 0x50 };
+    queueBundle(500, 100, events, sizeof(events));
+
+    tickAt(1099);
+
+    expect_note_on(0, 0x40, 0x7F);
+    expect_note_on(1, 0x43, 0x50);
+    tickAt(1100);
+}
+
+static void test_midi_bundle_keeps_timeline_when_delivery_is_delayed(
+    UNUSED void** state)
+{
+    const u8 first[] = { 0x10, 0x40, 0x7F };
+    const u8 second[] = { 0x10, 0x41, 0x7F };
+    queueBundle(500, 100, first, sizeof(first));
+    wraps_scheduler_setTimestamp(1080);
+    queueBundle(600, 150, second, sizeof(second));
+
+    expect_note_on(0, 0x40, 0x7F);
+    tickAt(1100);
+
+    // a slower delivery only nudges the clock offset by one unit
+    tickAt(1200);
+    expect_note_on(0, 0x41, 0x7F);
+    tickAt(1201);
+}
+
+static void test_midi_bundle_orders_events_by_target_time(UNUSED void** state)
+{
+    const u8 later[] = { 0x10, 0x41, 0x7F };
+    const u8 earlier[] = { 0x10, 0x40, 0x7F };
+    queueBundle(700, 300, later, sizeof(later));
+    queueBundle(600, 200, earlier, sizeof(earlier));
+
+    expect_note_on(0, 0x40, 0x7F);
+    expect_note_on(0, 0x41, 0x7F);
+    tickAt(1300);
+}
+
+static void test_midi_bundle_plays_channel_voice_messages(UNUSED void** state)
+{
+    const u8 events[] = { 0x00, 0x40, 0x00, 0x32, 0x07, 0x64, 0x42, 0x05,
+        0x63, 0x00, 0x50 };
+    queueBundle(500, 100, events, sizeof(events));
+
+    expect_value(__wrap_midi_noteOff, chan, 0);
+    expect_value(__wrap_midi_noteOff, pitch, 0x40);
+    expect_value(__wrap_midi_cc, chan, 2);
+    expect_value(__wrap_midi_cc, controller, 0x07);
+    expect_value(__wrap_midi_cc, value, 0x64);
+    expect_value(__wrap_midi_program, chan, 2);
+    expect_value(__wrap_midi_program, program, 0x05);
+    expect_value(__wrap_midi_pitchBend, chan, 3);
+    expect_value(__wrap_midi_pitchBend, bend, 0x2800);
+    tickAt(1100);
+}
+
+static void test_midi_bundle_ignores_events_after_invalid_status(
+    UNUSED void** state)
+{
+    const u8 events[] = { 0x10, 0x40, 0x7F, 0x70, 0x10, 0x41, 0x7F };
+    queueBundle(500, 100, events, sizeof(events));
+
+    expect_note_on(0, 0x40, 0x7F);
+    tickAt(1100);
+}
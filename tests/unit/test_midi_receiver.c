@@ -15,6 +15,7 @@
 #define STATUS_RESET 0xFF
 #define STATUS_SYSEX_START 0xF0
 #define SYSEX_END 0xF7
+#define STATUS_COMPACT 0xF5
 
 void midi_receiver_read(void);
 
@@ -241,8 +242,225 @@ static void test_midi_receiver_handles_sysex_limits(UNUSED void** state)
     expect_value(__wrap_midi_sysex, length, SYSEX_BUFFER_SIZE);
 
     midi_receiver_read();
+}
+
+static void test_midi_receiver_ignores_data_beyond_sysex_limit(
+    UNUSED void** state)
+{
+    const u16 SYSEX_MESSAGE_SIZE = 300;
+    midi_receiver_init();
+
+    stub_comm_read_returns_midi_event(0x91, 60, 100);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 100);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, STATUS_SYSEX_START);
+    for (u16 i = 0; i < SYSEX_MESSAGE_SIZE; i++) {
+        will_return(__wrap_comm_read, 0x12);
+    }
+    will_return(__wrap_comm_read, SYSEX_END);
+    expect_any(__wrap_midi_sysex, data);
+    expect_any(__wrap_midi_sysex, length);
+    midi_receiver_read();
+}
+
+static void test_midi_receiver_ends_unterminated_sysex_at_next_status(
+    UNUSED void** state)
+{
+    midi_receiver_init();
+
+    will_return(__wrap_comm_read, STATUS_SYSEX_START);
+    will_return(__wrap_comm_read, 0x12);
+    will_return(__wrap_comm_read, 0x91);
+    expect_value(__wrap_midi_sysex, length, 1);
+    expect_any(__wrap_midi_sysex, data);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, 60);
+    will_return(__wrap_comm_read, 100);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 100);
+    midi_receiver_read();
+}
+
+static void test_midi_receiver_handles_running_status(UNUSED void** state)
+{
+    midi_receiver_init();
+
+    stub_comm_read_returns_midi_event(0x91, 60, 100);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 100);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, 64);
+    will_return(__wrap_comm_read, 90);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 64);
+    expect_value(__wrap_midi_noteOn, velocity, 90);
+    midi_receiver_read();
+}
+
+static void test_midi_receiver_keeps_running_status_across_realtime_messages(
+    UNUSED void** state)
+{
+    midi_receiver_init();
+
+    stub_comm_read_returns_midi_event(STATUS_CC, CC_VOLUME, 100);
+    expect_value(__wrap_midi_cc, chan, 0);
+    expect_value(__wrap_midi_cc, controller, CC_VOLUME);
+    expect_value(__wrap_midi_cc, value, 100);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, STATUS_CLOCK);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, CC_VOLUME);
+    will_return(__wrap_comm_read, 50);
+    expect_value(__wrap_midi_cc, chan, 0);
+    expect_value(__wrap_midi_cc, controller, CC_VOLUME);
+    expect_value(__wrap_midi_cc, value, 50);
+    midi_receiver_read();
+}
+
+static void test_midi_receiver_reads_messages_while_sysex_suspended(
+    UNUSED void** state)
+{
+    const u8 data[] = { 0x12, 0x34 };
+
+    wraps_comm_setSysexSuspended(true);
+    will_return(__wrap_comm_read, STATUS_SYSEX_START);
+    midi_receiver_read();
+
+    stub_comm_read_returns_midi_event(0x90, 60, 100);
+    expect_value(__wrap_midi_noteOn, chan, 0);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 100);
+    midi_receiver_read();
+
+    wraps_comm_setSysexSuspended(false);
+    will_return(__wrap_comm_read, data[0]);
+    will_return(__wrap_comm_read, data[1]);
+    will_return(__wrap_comm_read, SYSEX_END);
+    expect_memory(__wrap_midi_sysex, data, data, sizeof(data));
+    expect_value(__wrap_midi_sysex, length, sizeof(data));
+    midi_receiver_read();
+}
+
+static void test_midi_receiver_keeps_running_status_across_queued_sysex(
+    UNUSED void** state)
+{
+    midi_receiver_init();
+    wraps_comm_setSysexQueued(true);
+
+    stub_comm_read_returns_midi_event(0x91, 60, 100);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 100);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, STATUS_SYSEX_START);
+    will_return(__wrap_comm_read, SYSEX_END);
+    expect_any(__wrap_midi_sysex, data);
+    expect_value(__wrap_midi_sysex, length, 0);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, 64);
+    will_return(__wrap_comm_read, 90);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 64);
+    expect_value(__wrap_midi_noteOn, velocity, 90);
+    midi_receiver_read();
+
+    wraps_comm_setSysexQueued(false);
+}
+
+static void test_midi_receiver_clears_running_status_after_inline_sysex(
+    UNUSED void** state)
+{
+    midi_receiver_init();
+
+    stub_comm_read_returns_midi_event(0x91, 60, 100);
+    expect_value(__wrap_midi_noteOn, chan, 1);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 100);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, STATUS_SYSEX_START);
+    will_return(__wrap_comm_read, SYSEX_END);
+    expect_any(__wrap_midi_sysex, data);
+    expect_value(__wrap_midi_sysex, length, 0);
+    midi_receiver_read();
+
+    wraps_enable_logging_checks();
+    will_return(__wrap_comm_read, 64);
+    expect_log_warn("Status? %02X");
+    midi_receiver_read();
+    wraps_disable_logging_checks();
+}
+
+static void test_midi_receiver_handles_compact_note_on_with_implicit_velocity(
+    UNUSED void** state)
+{
+    midi_receiver_init();
+
+    stub_comm_read_returns_midi_event(0x92, 60, 80);
+    expect_value(__wrap_midi_noteOn, chan, 2);
+    expect_value(__wrap_midi_noteOn, pitch, 60);
+    expect_value(__wrap_midi_noteOn, velocity, 80);
+    midi_receiver_read();
 
-    for (u16 i = 0; i < SYSEX_MESSAGE_SIZE - SYSEX_BUFFER_SIZE + 1; i++) {
-        comm_read();
+    will_return(__wrap_comm_read, STATUS_COMPACT);
+    will_return(__wrap_comm_read, 0x02);
+    midi_receiver_read();
+
+    for (u8 pitch = 62; pitch < 65; pitch++) {
+        will_return(__wrap_comm_read, pitch);
+        expect_value(__wrap_midi_noteOn, chan, 2);
+        expect_value(__wrap_midi_noteOn, pitch, pitch);
+        expect_value(__wrap_midi_noteOn, velocity, 80);
+        midi_receiver_read();
+    }
+}
+
+static void test_midi_receiver_handles_compact_note_off(UNUSED void** state)
+{
+    midi_receiver_init();
+
+    will_return(__wrap_comm_read, STATUS_COMPACT);
+    will_return(__wrap_comm_read, 0x13);
+    midi_receiver_read();
+
+    will_return(__wrap_comm_read, 60);
+    expect_value(__wrap_midi_noteOff, chan, 3);
+    expect_value(__wrap_midi_noteOff, pitch, 60);
+    midi_receiver_read();
+}
+
+static void test_midi_receiver_handles_compact_cc_delta_stream(
+    UNUSED void** state)
+{
+    midi_receiver_init();
+
+    will_return(__wrap_comm_read, STATUS_COMPACT);
+    will_return(__wrap_comm_read, 0x20);
+    will_return(__wrap_comm_read, CC_VOLUME);
+    will_return(__wrap_comm_read, 100);
+    expect_value(__wrap_midi_cc, chan, 0);
+    expect_value(__wrap_midi_cc, controller, CC_VOLUME);
+    expect_value(__wrap_midi_cc, value, 100);
+    midi_receiver_read();
+
+    const u8 deltas[] = { 0x05, 0x7E, 0x3F };
+    const u8 values[] = { 105, 103, 127 };
+    for (u8 i = 0; i < sizeof(deltas); i++) {
+        will_return(__wrap_comm_read, deltas[i]);
+        expect_value(__wrap_midi_cc, chan, 0);
+        expect_value(__wrap_midi_cc, controller, CC_VOLUME);
+        expect_value(__wrap_midi_cc, value, values[i]);
+        midi_receiver_read();
     }
 }
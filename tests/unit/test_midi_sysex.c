@@ -195,3 +195,58 @@ static void test_midi_sysex_loads_psg_envelope(UNUSED void** state)
 
     __real_midi_sysex(sequence, sizeof(sequence));
 }
+
+static void test_midi_sysex_sets_network_jitter_buffer_cap(UNUSED void** state)
+{
+    const u8 sequence[] = { SYSEX_EXTENDED_MANU_ID_SECTION,
+        SYSEX_UNUSED_EUROPEAN_SECTION, SYSEX_UNUSED_MANU_ID,
+        SYSEX_JITTER_BUFFER_COMMAND_ID, 20 };
+
+    expect_value(__wrap_applemidi_setJitterBufferCap, cap, 200);
+
+    __real_midi_sysex(sequence, sizeof(sequence));
+}
+
+static void test_midi_sysex_queues_timestamped_bundle(UNUSED void** state)
+{
+    const u8 sequence[] = { SYSEX_EXTENDED_MANU_ID_SECTION,
+        SYSEX_UNUSED_EUROPEAN_SECTION, SYSEX_UNUSED_MANU_ID,
+        SYSEX_BUNDLE_COMMAND_ID, /* target */ 0x00, 0x00, 0x03, 0x74,
+        /* lookahead */ 0x00, 0x64, /* note on */ 0x10, 0x40, 0x7F };
+    midi_bundle_init();
+    wraps_scheduler_setTimestamp(1000);
+
+    __real_midi_sysex(sequence, sizeof(sequence));
+
+    expect_value(__wrap_midi_noteOn, chan, 0);
+    expect_value(__wrap_midi_noteOn, pitch, 0x40);
+    expect_value(__wrap_midi_noteOn, velocity, 0x7F);
+    wraps_scheduler_setTimestamp(1100);
+    __real_midi_bundle_tick();
+}
+
+static const u8 pingSequence[] = { SYSEX_EXTENDED_MANU_ID_SECTION,
+    SYSEX_UNUSED_EUROPEAN_SECTION, SYSEX_UNUSED_MANU_ID, 0x01 };
+
+static void test_midi_sysex_replies_to_ping(UNUSED void** state)
+{
+    const u8 pong[] = { 0xF0, SYSEX_EXTENDED_MANU_ID_SECTION,
+        SYSEX_UNUSED_EUROPEAN_SECTION, SYSEX_UNUSED_MANU_ID, 0x02, 0xF7 };
+
+    will_return(__wrap_comm_writeAvailable, sizeof(pong));
+    for (u16 i = 0; i < sizeof(pong); i++) {
+        expect_value(__wrap_comm_write, data, pong[i]);
+    }
+
+    __real_midi_sysex(pingSequence, sizeof(pingSequence));
+}
+
+static void test_midi_sysex_drops_pong_if_tx_buffer_full(UNUSED void** state)
+{
+    wraps_enable_logging_checks();
+    will_return(__wrap_comm_writeAvailable, 5);
+    expect_log_warn("MIDI: Sysex dropped, TX buffer full");
+
+    __real_midi_sysex(pingSequence, sizeof(pingSequence));
+    wraps_disable_logging_checks();
+}
@@ -0,0 +1,48 @@
+#include "cmocka_inc.h"
+#include "mw/mpool.h"
+
+static void test_mpool_block_pool_allocates_until_exhausted(
+    UNUSED void** state)
+{
+    static u32 blocks[3][3];
+    struct mp_block_pool pool;
+    assert_int_equal(mp_block_pool_init(&pool, blocks, 12, 3), 0);
+
+    u8* block1 = mp_block_alloc(&pool);
+    u8* block2 = mp_block_alloc(&pool);
+    u8* block3 = mp_block_alloc(&pool);
+
+    assert_ptr_equal(block1, blocks[0]);
+    assert_ptr_equal(block2, blocks[1]);
+    assert_ptr_equal(block3, blocks[2]);
+    assert_null(mp_block_alloc(&pool));
+}
+
+static void test_mpool_block_pool_reuses_freed_blocks(UNUSED void** state)
+{
+    static u32 blocks[2][16];
+    struct mp_block_pool pool;
+    assert_int_equal(mp_block_pool_init(&pool, blocks, 64, 2), 0);
+
+    void* block1 = mp_block_alloc(&pool);
+    void* block2 = mp_block_alloc(&pool);
+    mp_block_free(&pool, block1);
+
+    assert_ptr_equal(mp_block_alloc(&pool), block1);
+    mp_block_free(&pool, block2);
+    mp_block_free(&pool, block1);
+    mp_block_pool_reset(&pool);
+
+    assert_ptr_equal(mp_block_alloc(&pool), block1);
+    assert_ptr_equal(mp_block_alloc(&pool), block2);
+    assert_null(mp_block_alloc(&pool));
+}
+
+static void test_mpool_block_pool_fails_if_blocks_cannot_hold_link(
+    UNUSED void** state)
+{
+    static u8 blocks[4][1];
+    struct mp_block_pool pool = {};
+
+    assert_int_equal(mp_block_pool_init(&pool, blocks, 1, 4), -1);
+}
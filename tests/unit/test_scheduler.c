@@ -4,6 +4,8 @@
 
 extern void __real_scheduler_init(void);
 extern void __real_scheduler_tick(void);
+extern u32 __real_scheduler_timestamp(void);
+extern void __real_scheduler_addTask(SchedulerTask* task);
 
 static int test_scheduler_setup(UNUSED void** state)
 {
@@ -20,14 +22,16 @@ static void test_scheduler_nothing_called_on_vsync(UNUSED void** state)
 static void test_scheduler_processes_frame_events_once_after_vsync(
     UNUSED void** state)
 {
-    expect_function_call(__wrap_comm_megawifi_tick);
+    expect_function_call(__wrap_midi_bundle_tick);
     expect_function_call(__wrap_midi_receiver_readIfCommReady);
+    expect_function_call(__wrap_comm_flush);
     __real_scheduler_tick();
 
     scheduler_vsync();
 
-    expect_function_call(__wrap_comm_megawifi_tick);
+    expect_function_call(__wrap_midi_bundle_tick);
     expect_function_call(__wrap_midi_receiver_readIfCommReady);
+    expect_function_call(__wrap_comm_flush);
     expect_function_call(__wrap_midi_psg_tick);
     expect_function_call(__wrap_ui_update);
     __real_scheduler_tick();
@@ -35,8 +39,84 @@ static void test_scheduler_processes_frame_events_once_after_vsync(
 
 static void test_scheduler_tick_runs_midi_receiver(UNUSED void** state)
 {
-    expect_function_call(__wrap_comm_megawifi_tick);
+    expect_function_call(__wrap_midi_bundle_tick);
     expect_function_call(__wrap_midi_receiver_readIfCommReady);
+    expect_function_call(__wrap_comm_flush);
 
     __real_scheduler_tick();
 }
+
+static void tick(void)
+{
+    expect_function_call(__wrap_midi_bundle_tick);
+    expect_function_call(__wrap_midi_receiver_readIfCommReady);
+    expect_function_call(__wrap_comm_flush);
+    __real_scheduler_tick();
+}
+
+static void tickWithFrame(void)
+{
+    scheduler_vsync();
+    expect_function_call(__wrap_midi_bundle_tick);
+    expect_function_call(__wrap_midi_receiver_readIfCommReady);
+    expect_function_call(__wrap_comm_flush);
+    expect_function_call(__wrap_midi_psg_tick);
+    expect_function_call(__wrap_ui_update);
+    __real_scheduler_tick();
+}
+
+static void test_scheduler_timestamp_interpolates_within_frame(
+    UNUSED void** state)
+{
+    wraps_region_setIsPal(true);
+    assert_int_equal(__real_scheduler_timestamp(), 0);
+
+    for (u8 i = 0; i < 4; i++) {
+        tick();
+    }
+    tickWithFrame();
+    assert_int_equal(__real_scheduler_timestamp(), 200);
+
+    tick();
+    tick();
+    assert_int_equal(__real_scheduler_timestamp(), 280);
+
+    for (u8 i = 0; i < 3; i++) {
+        tick();
+    }
+    assert_int_equal(__real_scheduler_timestamp(), 399);
+
+    tickWithFrame();
+    assert_int_equal(__real_scheduler_timestamp(), 400);
+}
+
+static u8 taskRuns;
+static bool taskCanFinish;
+
+static PtResult testTask(Pt* pt)
+{
+    PT_BEGIN(pt);
+    taskRuns++;
+    PT_WAIT_UNTIL(pt, taskCanFinish);
+    taskRuns++;
+    PT_END(pt);
+}
+
+static void test_scheduler_runs_tasks_on_tick_until_ended(UNUSED void** state)
+{
+    static SchedulerTask task = { .run = testTask };
+    taskRuns = 0;
+    taskCanFinish = false;
+    __real_scheduler_addTask(&task);
+
+    tick();
+    tick();
+    assert_int_equal(taskRuns, 1);
+
+    taskCanFinish = true;
+    tick();
+    assert_int_equal(taskRuns, 2);
+
+    tick();
+    assert_int_equal(taskRuns, 2);
+}
@@ -1,5 +1,6 @@
 #include "cmocka_inc.h"
 
+#include "comm_megawifi.h"
 #include "synth.h"
 
 #include <stdbool.h>
@@ -7,8 +8,6 @@
 static bool disableChecks = false;
 static bool loggingChecks = false;
 
-int _eflash;
-
 void wraps_disable_checks(void)
 {
     disableChecks = true;
@@ -215,6 +214,16 @@ void __wrap_comm_write(u8 data)
     check_expected(data);
 }
 
+u16 __wrap_comm_writeAvailable(void)
+{
+    return mock_type(u16);
+}
+
+void __wrap_comm_flush(void)
+{
+    function_called();
+}
+
 bool __wrap_comm_readReady(void)
 {
     return mock_type(bool);
@@ -225,6 +234,28 @@ u8 __wrap_comm_read(void)
     return mock_type(u8);
 }
 
+static bool commSysexQueued = false;
+bool __wrap_comm_sysexQueued(void)
+{
+    return commSysexQueued;
+}
+
+void wraps_comm_setSysexQueued(bool queued)
+{
+    commSysexQueued = queued;
+}
+
+static bool commSysexSuspended = false;
+bool __wrap_comm_sysexSuspended(void)
+{
+    return commSysexSuspended;
+}
+
+void wraps_comm_setSysexSuspended(bool suspended)
+{
+    commSysexSuspended = suspended;
+}
+
 u16 __wrap_comm_idleCount(void)
 {
     return mock_type(u16);
@@ -508,6 +539,11 @@ void __wrap_comm_everdrive_pro_write(u8 data)
     check_expected(data);
 }
 
+void __wrap_comm_everdrive_pro_flush(void)
+{
+    function_called();
+}
+
 void __wrap_SPR_setAnim(Sprite* sprite, s16 anim)
 {
 }
@@ -619,12 +655,20 @@ void wraps_region_setIsPal(bool isPal)
     regionIsPal = isPal;
 }
 
-void __wrap_comm_megawifi_midiEmitCallback(u8 midiByte)
+void mock_comm_megawifi_midiEmitByte(u8 midiByte)
 {
     print_message("MIDI Emit: %02X\n", midiByte);
     check_expected(midiByte);
 }
 
+void __wrap_comm_megawifi_midiEmit(u8 status, u8* data, u16 length)
+{
+    mock_comm_megawifi_midiEmitByte(status);
+    for (u16 i = 0; i < length; i++) {
+        mock_comm_megawifi_midiEmitByte(data[i]);
+    }
+}
+
 mw_err __wrap_mediator_recv_event(void)
 {
     function_called();
@@ -660,22 +704,18 @@ void __wrap_mw_process(void)
     function_called();
 }
 
-static u8 mock_ver_major;
-static u8 mock_ver_minor;
-
-void mock_mw_detect(u8 major, u8 minor)
+void __wrap_mw_start(void)
 {
-    mock_ver_major = major;
-    mock_ver_minor = minor;
+    if (disableChecks)
+        return;
+    function_called();
 }
 
-mw_err __wrap_mw_detect(uint8_t* major, uint8_t* minor, char** variant)
+void __wrap_mw_reset_fifos(void)
 {
     if (disableChecks)
-        return MW_ERR_NONE;
-    *major = mock_ver_major;
-    *minor = mock_ver_minor;
-    return mock_type(mw_err);
+        return;
+    function_called();
 }
 
 int __wrap_loop_init(uint8_t max_func, uint8_t max_timer)
@@ -695,66 +735,53 @@ int __wrap_loop_func_add(struct loop_func* func)
     return mock_type(mw_err);
 }
 
-mw_err __wrap_mw_ap_assoc(uint8_t slot)
+mw_err __wrap_mw_sock_conn_wait(uint8_t ch, int tout_frames)
 {
     if (disableChecks)
         return MW_ERR_NONE;
-    check_expected(slot);
+    check_expected(ch);
+    check_expected(tout_frames);
     return mock_type(mw_err);
 }
 
-mw_err __wrap_mw_ap_assoc_wait(int tout_frames)
+void __wrap_midi_receiver_readIfCommReady(void)
 {
-    if (disableChecks)
-        return MW_ERR_NONE;
-    check_expected(tout_frames);
-    return mock_type(mw_err);
+    function_called();
 }
 
-static struct mw_ip_cfg mock_mw_ip_cfg = {};
-
-void mock_ip_cfg(u32 ip_addr)
+void __wrap_midi_bundle_tick(void)
 {
-    mock_mw_ip_cfg.addr.addr = ip_addr;
+    function_called();
 }
 
-mw_err __wrap_mw_ip_current(struct mw_ip_cfg** ip)
+void __wrap_scheduler_tick(void)
 {
-    (*ip) = &mock_mw_ip_cfg;
-    if (disableChecks)
-        return MW_ERR_NONE;
-    return mock_type(mw_err);
+    function_called();
 }
 
-mw_err __wrap_mw_udp_set(uint8_t ch, const char* dst_addr, const char* dst_port,
-    const char* src_port)
+static SchedulerTask* addedTask = NULL;
+
+void __wrap_scheduler_addTask(SchedulerTask* task)
 {
-    if (disableChecks)
-        return MW_ERR_NONE;
-    check_expected(ch);
-    check_expected(dst_addr);
-    check_expected(dst_port);
-    check_expected(src_port);
-    return mock_type(mw_err);
+    addedTask = task;
+    function_called();
 }
 
-mw_err __wrap_mw_sock_conn_wait(uint8_t ch, int tout_frames)
+SchedulerTask* wraps_scheduler_addedTask(void)
 {
-    if (disableChecks)
-        return MW_ERR_NONE;
-    check_expected(ch);
-    check_expected(tout_frames);
-    return mock_type(mw_err);
+    return addedTask;
 }
 
-void __wrap_midi_receiver_readIfCommReady(void)
+static u32 schedulerTimestamp = 0;
+
+u32 __wrap_scheduler_timestamp(void)
 {
-    function_called();
+    return schedulerTimestamp;
 }
 
-void __wrap_scheduler_tick(void)
+void wraps_scheduler_setTimestamp(u32 timestamp)
 {
-    function_called();
+    schedulerTimestamp = timestamp;
 }
 
 void __wrap_comm_megawifi_tick(void)
@@ -762,13 +789,27 @@ void __wrap_comm_megawifi_tick(void)
     function_called();
 }
 
-void __wrap_comm_megawifi_send(u8 ch, char* data, u16 len)
+char* __wrap_comm_megawifi_reserveSend(void)
+{
+    static char sendBuffer[COMM_MEGAWIFI_SEND_MAX_LEN];
+    return sendBuffer;
+}
+
+void __wrap_comm_megawifi_queueSend(
+    u8 ch, u32 remoteIp, u16 remotePort, char* payload, u16 len)
 {
     check_expected(ch);
-    check_expected(data);
+    check_expected(remoteIp);
+    check_expected(remotePort);
+    check_expected(payload);
     check_expected(len);
 }
 
+void __wrap_applemidi_setJitterBufferCap(u16 cap)
+{
+    check_expected(cap);
+}
+
 enum lsd_status __wrap_lsd_recv(
     char* buf, int16_t len, void* ctx, lsd_recv_cb recv_cb)
 {
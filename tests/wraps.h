@@ -8,15 +8,20 @@
 #include "mw/megawifi.h"
 #include "log.h"
 #include "synth.h"
+#include "scheduler.h"
 
 extern bool __real_comm_readReady(void);
 extern void __real_comm_init(void);
 extern void __real_comm_write(u8 data);
+extern u16 __real_comm_writeAvailable(void);
+extern void __real_comm_flush(void);
 extern u8 __real_comm_read(void);
+extern bool __real_comm_sysexQueued(void);
+extern bool __real_comm_sysexSuspended(void);
 extern u16 __real_comm_idleCount(void);
 extern u16 __real_comm_busyCount(void);
 extern void __real_comm_resetCounts(void);
-extern void __real_comm_megawifi_midiEmitCallback(u8 midiByte);
+extern void __real_comm_megawifi_midiEmit(u8 status, u8* data, u16 length);
 
 void wraps_disable_checks(void);
 void wraps_enable_checks(void);
@@ -54,6 +59,8 @@ const Global* __wrap_synth_globalParameters();
 bool __wrap_comm_readReady(void);
 u8 __wrap_comm_read(void);
 void __wrap_comm_write(u8 data);
+u16 __wrap_comm_writeAvailable(void);
+void __wrap_comm_flush(void);
 void __wrap_comm_megawifi_init(void);
 void __wrap_fm_writeReg(u16 part, u8 reg, u8 data);
 void __wrap_psg_noteOn(u8 channel, u16 freq);
@@ -117,6 +124,7 @@ u8 __wrap_comm_everdrive_pro_readReady(void);
 u8 __wrap_comm_everdrive_pro_read(void);
 u8 __wrap_comm_everdrive_pro_writeReady(void);
 void __wrap_comm_everdrive_pro_write(u8 data);
+void __wrap_comm_everdrive_pro_flush(void);
 
 u16 __wrap_SYS_getCPULoad();
 u32 __wrap_getFPS();
@@ -127,32 +135,38 @@ Log* __wrap_log_dequeue(void);
 void __wrap_VDP_clearTextArea(u16 x, u16 y, u16 w, u16 h);
 bool __wrap_region_isPal(void);
 void wraps_region_setIsPal(bool isPal);
+void wraps_comm_setSysexQueued(bool queued);
+void wraps_comm_setSysexSuspended(bool suspended);
 
-void __wrap_comm_megawifi_midiEmitCallback(u8 midiByte);
+void mock_comm_megawifi_midiEmitByte(u8 midiByte);
+void __wrap_comm_megawifi_midiEmit(u8 status, u8* data, u16 length);
 mw_err __wrap_mediator_recv_event(void);
 mw_err __wrap_mediator_send_packet(u8 ch, char* data, u16 len);
 void __wrap_SYS_die(char* err);
 
 int __wrap_mw_init(char* cmd_buf, uint16_t buf_len);
 void __wrap_mw_process(void);
-mw_err __wrap_mw_detect(uint8_t* major, uint8_t* minor, char** variant);
-
-void mock_mw_detect(u8 major, u8 minor);
+void __wrap_mw_start(void);
+void __wrap_mw_reset_fifos(void);
 
 int __wrap_loop_init(uint8_t max_func, uint8_t max_timer);
 int __wrap_loop_func_add(struct loop_func* func);
-mw_err __wrap_mw_ap_assoc(uint8_t slot);
-mw_err __wrap_mw_ap_assoc_wait(int tout_frames);
-mw_err __wrap_mw_ip_current(struct mw_ip_cfg** ip);
-void mock_ip_cfg(u32 ip_addr);
-mw_err __wrap_mw_udp_set(uint8_t ch, const char* dst_addr, const char* dst_port,
-    const char* src_port);
 mw_err __wrap_mw_sock_conn_wait(uint8_t ch, int tout_frames);
 
 void __wrap_midi_receiver_readIfCommReady(void);
+void __wrap_midi_bundle_tick(void);
+extern void __real_midi_bundle_tick(void);
 void __wrap_scheduler_tick(void);
+u32 __wrap_scheduler_timestamp(void);
+void __wrap_scheduler_addTask(SchedulerTask* task);
+SchedulerTask* wraps_scheduler_addedTask(void);
+void wraps_scheduler_setTimestamp(u32 timestamp);
 void __wrap_comm_megawifi_tick(void);
-void __wrap_comm_megawifi_send(u8 ch, char* data, u16 len);
+char* __wrap_comm_megawifi_reserveSend(void);
+void __wrap_comm_megawifi_queueSend(
+    u8 ch, u32 remoteIp, u16 remotePort, char* payload, u16 len);
+void __wrap_applemidi_setJitterBufferCap(u16 cap);
+extern void __real_applemidi_setJitterBufferCap(u16 cap);
 
 enum lsd_status __wrap_lsd_recv(
     char* buf, int16_t len, void* ctx, lsd_recv_cb recv_cb);